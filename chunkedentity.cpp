@@ -35,6 +35,14 @@ static float screenSpaceError(ChunkNode* node, const SceneState& state)
 {
   float dist = node->bbox.distanceFromPoint(state.cameraPos);
 
+  if (node->hasBoundingSphere)
+  {
+    // both the box and the sphere enclose the whole chunk, so the larger
+    // of the two distances is still a lower bound - and a tighter one
+    float sphereDist = node->sphereCenter.distanceToPoint(state.cameraPos) - node->sphereRadius;
+    dist = qMax(dist, sphereDist);
+  }
+
   // TODO: what to do when distance == 0 ?
 
   float sse = screenSpaceError(node->error, dist, state.screenSizePx, state.cameraFov);
@@ -77,6 +85,24 @@ static bool isInFrustum(const AABB& bbox, const QMatrix4x4& viewProjectionMatrix
   return AABB(-1, -1, -1, 1, 1, 1).intersects(AABB(xmin, ymin, zmin, xmax, ymax, zmax));
 }
 
+//! sphere vs frustum test for culling.
+//! frustum planes are extracted from the view-projection matrix (Gribb & Hartmann),
+//! so unlike the box test above this one also behaves for geometry behind the camera
+static bool isInFrustum(const QVector3D& center, float radius, const QMatrix4x4& viewProjectionMatrix)
+{
+  const QVector4D rowW = viewProjectionMatrix.row(3);
+  for (int i = 0; i < 6; ++i)
+  {
+    const QVector4D row = viewProjectionMatrix.row(i / 2);
+    const QVector4D plane = (i % 2) ? rowW - row : rowW + row;
+    const QVector3D normal = plane.toVector3D();
+    float dist = (QVector3D::dotProduct(normal, center) + plane.w()) / normal.length();
+    if (dist < -radius)
+      return false;
+  }
+  return true;
+}
+
 
 ChunkedEntity::ChunkedEntity(const AABB &rootBbox, float rootError, float tau, int maxLevel, ChunkLoaderFactory *loaderFactory, Qt3DCore::QNode *parent)
   : Qt3DCore::QEntity(parent)
@@ -99,10 +125,39 @@ ChunkedEntity::ChunkedEntity(const AABB &rootBbox, float rootError, float tau, i
 
 ChunkedEntity::~ChunkedEntity()
 {
+  stopLoading();
+
+  delete chunkLoaderQueue;
+
+  while (!replacementQueue->isEmpty())
+  {
+    ChunkListEntry* entry = replacementQueue->takeFirst();
+
+    // remove loaded data from node
+    entry->chunk->unloadChunk(); // also deletes the entry
+  }
+
+  delete replacementQueue;
+  delete rootNode;
+
+  // TODO: shall we own the factory or not?
+  //delete chunkLoaderFactory;
+}
+
+
+void ChunkedEntity::stopLoading()
+{
+  if (!loaderThread)
+    return;  // stopped already
+
+  loaderMutex.lock();
   loaderThread->setStopping(true);
+  loaderThread->cancelCurrentLoad();  // the loader may be blocked (e.g. waiting for a download)
   loaderWaitCondition.wakeOne();  // may be waiting
+  loaderMutex.unlock();
   loaderThread->wait();
   delete loaderThread;
+  loaderThread = nullptr;
 
   // clean up any pending load requests
   while (!chunkLoaderQueue->isEmpty())
@@ -111,6 +166,7 @@ ChunkedEntity::~ChunkedEntity()
     ChunkNode* node = entry->chunk;
 
     delete entry;
+    node->loader->cancel();  // e.g. drop its queued downloads
     delete node->loader;
 
     // unload node that is in "loading" state
@@ -119,21 +175,6 @@ ChunkedEntity::~ChunkedEntity()
     node->loader = nullptr;
   }
 
-  delete chunkLoaderQueue;
-
-  while (!replacementQueue->isEmpty())
-  {
-    ChunkListEntry* entry = replacementQueue->takeFirst();
-
-    // remove loaded data from node
-    entry->chunk->unloadChunk(); // also deletes the entry
-  }
-
-  delete replacementQueue;
-  delete rootNode;
-
-  // TODO: shall we own the factory or not?
-  //delete chunkLoaderFactory;
 }
 
 
@@ -188,6 +229,14 @@ void ChunkedEntity::update(const SceneState &state)
   qDebug() << "update: active " << activeNodes.count() << " enabled " << enabled << " disabled " << disabled << " | culled " << frustumCulled << " | loading " << chunkLoaderQueue->count() << " loaded " << replacementQueue->count() << " | unloaded " << unloaded;
 }
 
+QList<ChunkNode *> ChunkedEntity::loadedNodes() const
+{
+  QList<ChunkNode*> nodes;
+  for (ChunkListEntry* entry = replacementQueue->first(); entry; entry = entry->next)
+    nodes << entry->chunk;
+  return nodes;
+}
+
 void ChunkedEntity::setShowBoundingBoxes(bool enabled)
 {
   if ((enabled && bboxesEntity) || (!enabled && !bboxesEntity))
@@ -214,7 +263,18 @@ void ChunkedEntity::update(ChunkNode *node, const SceneState &state)
     return;
   }
 
-  node->ensureAllChildrenExist();
+  if (node->hasBoundingSphere && !isInFrustum(node->sphereCenter, node->sphereRadius, state.viewProjectionMatrix))
+  {
+    ++frustumCulled;
+    return;
+  }
+
+  if (node->ensureAllChildrenExist())
+  {
+    // give the factory a chance to provide better bounding boxes than the parent's estimate
+    for (int i = 0; i < 4; ++i)
+      chunkLoaderFactory->updateSkeletonBbox(node->children[i]);
+  }
 
   // make sure all nodes leading to children are always loaded
   // so that zooming out does not create issues
@@ -325,7 +385,14 @@ LoaderThread::LoaderThread(ChunkList *list, QMutex &mutex, QWaitCondition& waitC
   , mutex(mutex)
   , waitCondition(waitCondition)
   , stopping(false)
+  , currentLoader(nullptr)
+{
+}
+
+void LoaderThread::cancelCurrentLoad()
 {
+  if (currentLoader)
+    currentLoader->cancel();
 }
 
 void LoaderThread::run()
@@ -346,12 +413,17 @@ void LoaderThread::run()
 
     Q_ASSERT(!loadList->isEmpty());
     entry = loadList->takeFirst();
+    currentLoader = entry->chunk->loader;
     mutex.unlock();
 
     qDebug() << "[THR] loading! " << entry->chunk->x << " | " << entry->chunk->y << " | " << entry->chunk->z;
 
     entry->chunk->loader->load();
 
+    mutex.lock();
+    currentLoader = nullptr;
+    mutex.unlock();
+
     qDebug() << "[THR] done!";
 
     emit nodeLoaded(entry->chunk);
@@ -8,6 +8,7 @@
 class AABB;
 class ChunkNode;
 class ChunkList;
+class ChunkLoader;
 class ChunkLoaderFactory;
 class TerrainBoundsEntity;
 class LoaderThread;
@@ -37,12 +38,23 @@ public:
   ~ChunkedEntity();
 
   //!< called when e.g. camera changes and entity may need updated
-  void update(const SceneState& state);
+  virtual void update(const SceneState& state);
 
   bool needsUpdate; //!< a chunk has been loaded recently - let's display it!
 
   void setShowBoundingBoxes(bool enabled);
 
+protected:
+  //! Returns all nodes that are currently loaded (most recently used first)
+  QList<ChunkNode*> loadedNodes() const;
+
+  //! Stops the loader thread and drops pending loaders. Derived classes call it in their destructor
+  //! if the loaders use something that the derived class owns. Can be called repeatedly
+  void stopLoading();
+
+  //! nodes selected for rendering by the last update
+  QList<ChunkNode*> activeNodes;
+
 private:
   void update(ChunkNode* node, const SceneState& state);
 
@@ -66,7 +78,6 @@ private:
   //! queue of chunk to be eventually replaced
   ChunkList* replacementQueue;
 
-  QList<ChunkNode*> activeNodes;
   int frustumCulled;
 
   // TODO: max. length for loading queue
@@ -94,6 +105,9 @@ public:
 
   void setStopping(bool stop) { stopping = stop; }
 
+  //! Cancels loading of the chunk that is currently being loaded (if any). Mutex must be locked
+  void cancelCurrentLoad();
+
   void run() override;
 
 signals:
@@ -104,6 +118,7 @@ private:
   QMutex& mutex;
   QWaitCondition& waitCondition;
   bool stopping;
+  ChunkLoader* currentLoader;  //!< loader running in the thread (guarded by the mutex)
 };
 
 #endif // CHUNKEDENTITY_H
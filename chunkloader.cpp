@@ -1,9 +1,20 @@
 #include "chunkloader.h"
 
+#include <QtGlobal>
+
 ChunkLoader::~ChunkLoader()
 {
 }
 
+void ChunkLoader::cancel()
+{
+}
+
 ChunkLoaderFactory::~ChunkLoaderFactory()
 {
 }
+
+void ChunkLoaderFactory::updateSkeletonBbox(ChunkNode *node) const
+{
+  Q_UNUSED(node);
+}
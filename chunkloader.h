@@ -20,11 +20,16 @@ public:
 
   virtual ~ChunkLoader();
 
-  //! Run in worker thread to load data
+  //! Run in worker thread to load data. All CPU-heavy preparation (decoding, building of
+  //! vertex/index buffer data, bounds, texture data) should be done here
   virtual void load() = 0;
-  //! Run in main thread to use loaded data.
+  //! Run in main thread to use loaded data - should only wire the prepared data into Qt3D components.
   //! Returns entity attached to the given parent entity in disabled state
   virtual Qt3DCore::QEntity* createEntity(Qt3DCore::QEntity* parent) = 0;
+  //! Called from main thread while load() may be running in the worker thread when the result
+  //! is not needed anymore (e.g. the entity is being destroyed). Implementations that may block
+  //! in load() should make it return as soon as possible
+  virtual void cancel();
 
 protected:
   ChunkNode* node;
@@ -38,6 +43,10 @@ public:
   virtual ~ChunkLoaderFactory();
 
   virtual ChunkLoader* createChunkLoader(ChunkNode* node) const = 0;
+
+  //! Called in main thread when a new skeleton node is created. Implementations may set
+  //! a tighter bounding box than the rough estimate inherited from the parent node
+  virtual void updateSkeletonBbox(ChunkNode* node) const;
 };
 
 
@@ -9,6 +9,9 @@
 ChunkNode::ChunkNode(int x, int y, int z, const AABB &bbox, float error, ChunkNode* parent)
   : bbox(bbox)
   , error(error)
+  , hasExactError(false)
+  , hasBoundingSphere(false)
+  , sphereRadius(0)
   , x(x)
   , y(y)
   , z(z)
@@ -49,8 +52,11 @@ bool ChunkNode::allChildChunksResident(const QTime& currentTime) const
   return true;
 }
 
-void ChunkNode::ensureAllChildrenExist()
+bool ChunkNode::ensureAllChildrenExist()
 {
+  if (children[0] && children[1] && children[2] && children[3])
+    return false;
+
   float childError = error/2;
   float xc = bbox.xCenter(), zc = bbox.zCenter();
   float ymin = bbox.yMin;
@@ -67,6 +73,8 @@ void ChunkNode::ensureAllChildrenExist()
 
   if (!children[3])
     children[3] = new ChunkNode(x*2+1, y*2+0, z+1, AABB(xc, ymin, zc, bbox.xMax, ymax, bbox.zMax), childError, this);
+
+  return true;
 }
 
 int ChunkNode::level() const
@@ -124,5 +132,27 @@ void ChunkNode::setExactBbox(const AABB &box)
 {
   bbox = box;
 
-  // TODO: propagate better estimate to children?
+  // children that do not have their data yet keep their own estimates: they come from finer data
+  // than ours (e.g. height range pyramid of DEM) so our range does not necessarily contain them
+}
+
+void ChunkNode::setExactError(float err)
+{
+  error = err;
+  hasExactError = true;
+
+  // skeleton children that have not been loaded yet only have an estimate
+  // derived from our error - update it so that it follows the real data
+  for (int i = 0; i < 4; ++i)
+  {
+    if (children[i] && !children[i]->hasExactError)
+      children[i]->error = error/2;
+  }
+}
+
+void ChunkNode::setBoundingSphere(const QVector3D &center, float radius)
+{
+  sphereCenter = center;
+  sphereRadius = radius;
+  hasBoundingSphere = true;
 }
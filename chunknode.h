@@ -5,6 +5,7 @@
 #include "aabb.h"
 
 #include <QTime>
+#include <QVector3D>
 
 namespace Qt3DCore
 {
@@ -24,8 +25,9 @@ public:
 
   bool allChildChunksResident(const QTime& currentTime) const;
 
-  //! make sure that all child nodes are at least skeleton nodes
-  void ensureAllChildrenExist();
+  //! make sure that all child nodes are at least skeleton nodes.
+  //! Returns true if some child nodes had to be created
+  bool ensureAllChildrenExist();
 
   int level() const;
 
@@ -38,11 +40,22 @@ public:
   //! turn a loaded chunk into skeleton
   void unloadChunk();
 
-  //! called when bounding box
+  //! called when bounding box of the loaded data is known (does not affect bounding boxes of children)
   void setExactBbox(const AABB& box);
 
+  //! called when the loader has determined true geometric error of the chunk (in world coordinates)
+  void setExactError(float err);
+
+  //! called when the loader knows a bounding sphere of the chunk (in world coordinates)
+  void setBoundingSphere(const QVector3D& center, float radius);
+
   AABB bbox;      //!< bounding box in world coordinates
   float error;    //!< error of the node in world coordinates
+  bool hasExactError;  //!< whether the error has been calculated from data (otherwise it is just an estimate from the parent)
+
+  bool hasBoundingSphere;  //!< whether sphereCenter + sphereRadius are valid
+  QVector3D sphereCenter;  //!< center of the bounding sphere in world coordinates
+  float sphereRadius;      //!< radius of the bounding sphere in world coordinates
 
   int x,y,z;    //!< chunk coordinates (for use with a tiling scheme)
 
@@ -49,6 +49,7 @@ public:
   DemTerrainChunkLoader(Terrain* terrain, ChunkNode* node)
     : TerrainChunkLoader(terrain, node)
     , resolution(0)
+    , geometricError(0)
   {
   }
 
@@ -57,9 +58,18 @@ public:
     const Map3D& map = mTerrain->map3D();
     DemTerrainGenerator* generator = static_cast<DemTerrainGenerator*>(map.terrainGenerator.get());
 
-    heightMap = generator->heightMapGenerator()->renderSynchronously(node->x, node->y, node->z);
+    heightMap = generator->heightMapGenerator()->renderWithGeometricError(node->x, node->y, node->z, geometricError);
     resolution = generator->heightMapGenerator()->resolution();
 
+    float zMin, zMax;
+    _heightMapMinMax(heightMap, zMin, zMax);
+
+    QgsRectangle extent = map.terrainGenerator->terrainTilingScheme.tileToExtent(node->x, node->y, node->z);  //node->extent;
+    double x0 = extent.xMinimum() - map.originX;
+    double y0 = extent.yMinimum() - map.originY;
+    double side = extent.width();
+    bbox = AABB(x0, zMin*map.zExaggeration, -y0, x0 + side, zMax*map.zExaggeration, -(y0 + side));
+
     loadTexture();
   }
 
@@ -83,20 +93,15 @@ public:
     transform = new Qt3DCore::QTransform();
     entity->addComponent(transform);
 
-    float zMin, zMax;
-    _heightMapMinMax(heightMap, zMin, zMax);
-
     const Map3D& map = mTerrain->map3D();
-    QgsRectangle extent = map.terrainGenerator->terrainTilingScheme.tileToExtent(node->x, node->y, node->z);  //node->extent;
-    double x0 = extent.xMinimum() - map.originX;
-    double y0 = extent.yMinimum() - map.originY;
-    double side = extent.width();
-    double half = side/2;
+    float side = bbox.xExtent();
+    float half = side/2;
 
     transform->setScale3D(QVector3D(side, map.zExaggeration, side));
-    transform->setTranslation(QVector3D(x0 + half,0, - (y0 + half)));
+    transform->setTranslation(QVector3D(bbox.xMin + half, 0, bbox.zMin + half));
 
-    node->setExactBbox(AABB(x0, zMin*map.zExaggeration, -y0, x0 + side, zMax*map.zExaggeration, -(y0 + side)));
+    node->setExactBbox(bbox);
+    node->setExactError(geometricError * map.zExaggeration);
 
     entity->setEnabled(false);
     entity->setParent(parent);
@@ -107,6 +112,8 @@ private:
 
   QByteArray heightMap;
   int resolution;
+  float geometricError;  //!< max. difference of heights from the next finer level (in terrain's units)
+  AABB bbox;             //!< exact bounding box of the tile (in world coordinates)
 };
 
 
@@ -145,6 +152,13 @@ float DemTerrainGenerator::heightAt(double x, double y, const Map3D &map) const
   return mHeightMapGenerator->heightAt(x, y);
 }
 
+bool DemTerrainGenerator::tileHeightRange(int x, int y, int z, float &hMin, float &hMax) const
+{
+  if (!mHeightMapGenerator)
+    return false;
+  return mHeightMapGenerator->tileHeightRange(x, y, z, hMin, hMax);
+}
+
 void DemTerrainGenerator::writeXml(QDomElement& elem) const
 {
   elem.setAttribute("layer", mLayer.layerId);
@@ -191,16 +205,146 @@ void DemTerrainGenerator::updateGenerator()
 #include <QtConcurrent/QtConcurrentRun>
 #include <QFutureWatcher>
 
+#include <cmath>
+#include <limits>
+
+//! Builds min/max pyramid of heights (run in a worker thread with a clone of the data provider
+//! that gets deleted here). Returns empty pyramid if it fails or gets cancelled
+static DemHeightMapGenerator::HeightRangePyramid _buildHeightRangePyramid(QgsRasterDataProvider* dtmProvider, const QgsRectangle& fullExtent, const QgsRectangle& dtmExtent,
+                                                                          double pixelX, double pixelY, QSharedPointer<QAtomicInt> cancelled)
+{
+  std::unique_ptr<QgsRasterDataProvider> provider(dtmProvider);
+  DemHeightMapGenerator::HeightRangePyramid pyramid;
+  if (pixelX <= 0 || pixelY <= 0)
+    return pyramid;
+  QVector< QVector<float> >& heightMinPyramid = pyramid.min;
+  QVector< QVector<float> >& heightMaxPyramid = pyramid.max;
+
+  // tiles of the base level are not smaller than a pixel of the DEM (with at most 1024x1024 tiles)
+  int baseLevel = 0;
+  while (baseLevel < 10 && fullExtent.width() / (2 << baseLevel) >= qMax(pixelX, pixelY))
+    ++baseLevel;
+  int n = 1 << baseLevel;
+  double tileSize = fullExtent.width() / n;
+
+  heightMinPyramid.resize(baseLevel + 1);
+  heightMaxPyramid.resize(baseLevel + 1);
+
+  QVector<float>& baseMin = heightMinPyramid[baseLevel];
+  QVector<float>& baseMax = heightMaxPyramid[baseLevel];
+  baseMin.fill(std::numeric_limits<float>::max(), n*n);    // min > max for tiles with no data
+  baseMax.fill(-std::numeric_limits<float>::max(), n*n);
+
+  // the base level gets range of all DEM pixels at the native resolution, read by rows of tiles.
+  // Each pixel goes to all tiles its footprint touches, so that the ranges always bound the terrain
+  for (int ty = 0; ty < n; ++ty)
+  {
+    if (cancelled->load())
+      return DemHeightMapGenerator::HeightRangePyramid();
+
+    double yMin = fullExtent.yMinimum() + ty * tileSize;
+    QgsRectangle rowExtent(fullExtent.xMinimum() - pixelX, yMin - pixelY, fullExtent.xMaximum() + pixelX, yMin + tileSize + pixelY);
+    rowExtent = rowExtent.intersect(dtmExtent);
+    if (rowExtent.isEmpty())
+      continue;
+
+    int cols = qMax(1, (int) ceil(rowExtent.width() / pixelX));
+    int rows = qMax(1, (int) ceil(rowExtent.height() / pixelY));
+    QgsRasterBlock* block = provider->block(1, rowExtent, cols, rows);
+    if (!block)
+      continue;
+    block->convert(Qgis::Float32);   // currently we expect just floats
+    const float* data = (const float*) block->bits();
+
+    double blockPixelX = rowExtent.width() / cols, blockPixelY = rowExtent.height() / rows;
+    for (int row = 0; row < rows; ++row)
+    {
+      // raster rows go from top, tiles go from bottom
+      double pyMax = rowExtent.yMaximum() - row * blockPixelY;
+      int tyFrom = qBound(0, (int) floor((pyMax - blockPixelY - fullExtent.yMinimum()) / tileSize), n - 1);
+      int tyTo = qBound(0, (int) floor((pyMax - fullExtent.yMinimum()) / tileSize), n - 1);
+      tyFrom = qMax(tyFrom, ty - 1);
+      tyTo = qMin(tyTo, ty + 1);
+      for (int col = 0; col < cols; ++col)
+      {
+        if (block->isNoData(row, col))
+          continue;
+        float h = data[col + row*cols];
+        double pxMin = rowExtent.xMinimum() + col * blockPixelX;
+        int txFrom = qBound(0, (int) floor((pxMin - fullExtent.xMinimum()) / tileSize), n - 1);
+        int txTo = qBound(0, (int) floor((pxMin + blockPixelX - fullExtent.xMinimum()) / tileSize), n - 1);
+        for (int y = tyFrom; y <= tyTo; ++y)
+        {
+          for (int x = txFrom; x <= txTo; ++x)
+          {
+            int index = x + y*n;
+            baseMin[index] = qMin(baseMin[index], h);
+            baseMax[index] = qMax(baseMax[index], h);
+          }
+        }
+      }
+    }
+    delete block;
+  }
+
+  // every coarser level combines 2x2 tiles of the finer level
+  for (int z = baseLevel - 1; z >= 0; --z)
+  {
+    int levelSize = 1 << z;
+    const QVector<float>& fineMin = heightMinPyramid[z+1];
+    const QVector<float>& fineMax = heightMaxPyramid[z+1];
+    QVector<float>& levelMin = heightMinPyramid[z];
+    QVector<float>& levelMax = heightMaxPyramid[z];
+    levelMin.resize(levelSize*levelSize);
+    levelMax.resize(levelSize*levelSize);
+    for (int y = 0; y < levelSize; ++y)
+    {
+      for (int x = 0; x < levelSize; ++x)
+      {
+        int i0 = x*2 + y*2*levelSize*2, i1 = i0 + levelSize*2;
+        levelMin[x + y*levelSize] = qMin(qMin(fineMin[i0], fineMin[i0+1]), qMin(fineMin[i1], fineMin[i1+1]));
+        levelMax[x + y*levelSize] = qMax(qMax(fineMax[i0], fineMax[i0+1]), qMax(fineMax[i1], fineMax[i1+1]));
+      }
+    }
+  }
+  return pyramid;
+}
+
 DemHeightMapGenerator::DemHeightMapGenerator(QgsRasterLayer *dtm, const TilingScheme &tilingScheme, int resolution)
   : dtm(dtm)
   , tilingScheme(tilingScheme)
   , res(resolution)
   , lastJobId(0)
+  , pyramidReady(false)
+  , pyramidCancelled(new QAtomicInt(0))
 {
+  // reading the whole DEM at native resolution takes a while - do it in background.
+  // Until the pyramid is ready, tiles use the estimate inherited from their parent
+  QgsRasterDataProvider* provider = (QgsRasterDataProvider*)dtm->dataProvider()->clone();  // safe to use in worker thread
+  QgsRectangle fullExtent = tilingScheme.tileToExtent(0, 0, 0), dtmExtent = dtm->extent();
+  double pixelX = dtm->rasterUnitsPerPixelX(), pixelY = dtm->rasterUnitsPerPixelY();
+  QSharedPointer<QAtomicInt> cancelled = pyramidCancelled;
+  pyramidFuture = QtConcurrent::run([provider, fullExtent, dtmExtent, pixelX, pixelY, cancelled]
+  {
+    return _buildHeightRangePyramid(provider, fullExtent, dtmExtent, pixelX, pixelY, cancelled);
+  });
 }
 
 DemHeightMapGenerator::~DemHeightMapGenerator()
 {
+  // the build may be still running - it does not use us, so just let it stop early
+  pyramidCancelled->store(1);
+}
+
+static QgsRectangle _heightMapExtent(const TilingScheme& tilingScheme, int x, int y, int z, int res)
+{
+  // extend the rect by half-pixel on each side? to get the values in "corners"
+  QgsRectangle extent = tilingScheme.tileToExtent(x, y, z);
+  float mapUnitsPerPixel = extent.width() / res;
+  extent.grow( mapUnitsPerPixel / 2);
+  // but make sure not to go beyond the full extent (returns invalid values)
+  QgsRectangle fullExtent = tilingScheme.tileToExtent(0, 0, 0);
+  return extent.intersect(fullExtent);
 }
 
 static QByteArray _readDtmData(QgsRasterDataProvider* provider, const QgsRectangle& extent, int res)
@@ -222,13 +366,7 @@ static QByteArray _readDtmData(QgsRasterDataProvider* provider, const QgsRectang
 
 int DemHeightMapGenerator::render(int x, int y, int z)
 {
-  // extend the rect by half-pixel on each side? to get the values in "corners"
-  QgsRectangle extent = tilingScheme.tileToExtent(x, y, z);
-  float mapUnitsPerPixel = extent.width() / res;
-  extent.grow( mapUnitsPerPixel / 2);
-  // but make sure not to go beyond the full extent (returns invalid values)
-  QgsRectangle fullExtent = tilingScheme.tileToExtent(0, 0, 0);
-  extent = extent.intersect(fullExtent);
+  QgsRectangle extent = _heightMapExtent(tilingScheme, x, y, z, res);
 
   JobData jd;
   jd.jobId = ++lastJobId;
@@ -248,13 +386,7 @@ int DemHeightMapGenerator::render(int x, int y, int z)
 
 QByteArray DemHeightMapGenerator::renderSynchronously(int x, int y, int z)
 {
-  // extend the rect by half-pixel on each side? to get the values in "corners"
-  QgsRectangle extent = tilingScheme.tileToExtent(x, y, z);
-  float mapUnitsPerPixel = extent.width() / res;
-  extent.grow( mapUnitsPerPixel / 2);
-  // but make sure not to go beyond the full extent (returns invalid values)
-  QgsRectangle fullExtent = tilingScheme.tileToExtent(0, 0, 0);
-  extent = extent.intersect(fullExtent);
+  QgsRectangle extent = _heightMapExtent(tilingScheme, x, y, z, res);
 
   QgsRasterBlock* block = dtm->dataProvider()->block(1, extent, res, res);
 
@@ -270,20 +402,93 @@ QByteArray DemHeightMapGenerator::renderSynchronously(int x, int y, int z)
   return data;
 }
 
+//! bilinear interpolation of height in a heightmap at normalized coordinates (0..1)
+static float _heightMapSample(const float* data, int res, float u, float v)
+{
+  float fx = u * (res - 1), fy = v * (res - 1);
+  int x0 = qBound(0, (int) fx, res - 2), y0 = qBound(0, (int) fy, res - 2);
+  float tx = fx - x0, ty = fy - y0;
+  float h00 = data[x0 + y0*res], h10 = data[x0 + 1 + y0*res];
+  float h01 = data[x0 + (y0+1)*res], h11 = data[x0 + 1 + (y0+1)*res];
+  return (h00 * (1 - tx) + h10 * tx) * (1 - ty) + (h01 * (1 - tx) + h11 * tx) * ty;
+}
+
+QByteArray DemHeightMapGenerator::renderWithGeometricError(int x, int y, int z, float &error)
+{
+  error = 0;
+  if (res < 2)
+    return renderSynchronously(x, y, z);
+
+  // the finer grid has a sample at each vertex of our mesh plus one between each two of them
+  // (like the next finer level), so the heightmap is just every other sample of it.
+  // Pixel centers of the heightmap are half of its pixel inside its extent, so the finer grid's extent
+  // is shrunk by a quarter of that pixel - its centers (with half the spacing) then start and end at the same places
+  QgsRectangle extent = _heightMapExtent(tilingScheme, x, y, z, res);
+  double dx = extent.width() / res / 4, dy = extent.height() / res / 4;
+  QgsRectangle fineExtent(extent.xMinimum() + dx, extent.yMinimum() + dy, extent.xMaximum() - dx, extent.yMaximum() - dy);
+  int fineRes = 2 * res - 1;
+
+  QgsRasterBlock* block = dtm->dataProvider()->block(1, fineExtent, fineRes, fineRes);
+  if (!block)
+    return QByteArray();
+
+  block->convert(Qgis::Float32);   // currently we expect just floats
+  QByteArray fineData = block->data();
+  delete block;
+
+  if (fineData.count() != fineRes * fineRes * (int)sizeof(float))
+    return QByteArray();
+
+  QByteArray heightMap(res * res * sizeof(float), Qt::Uninitialized);
+  float* coarse = (float*) heightMap.data();
+  const float* fine = (const float*) fineData.constData();
+  for (int j = 0; j < res; ++j)
+    for (int i = 0; i < res; ++i)
+      coarse[i + j*res] = fine[2*i + 2*j*fineRes];
+
+  // maximum vertical distance between the finer samples and our (bilinearly interpolated) mesh
+  float maxError = 0;
+  for (int j = 0; j < fineRes; ++j)
+  {
+    float v = j / float(fineRes - 1);
+    for (int i = 0; i < fineRes; ++i)
+    {
+      float u = i / float(fineRes - 1);
+      float err = qAbs(fine[i + j*fineRes] - _heightMapSample(coarse, res, u, v));
+      if (err > maxError)
+        maxError = err;
+    }
+  }
+  error = maxError;
+  return heightMap;
+}
+
 float DemHeightMapGenerator::heightAt(double x, double y)
 {
   // TODO: this is quite a primitive implementation: better to use heightmaps currently in use
   int res = 1024;
   QgsRectangle rect = dtm->extent();
-  if (dtmCoarseData.isEmpty())
   {
-    QgsRasterBlock* block = dtm->dataProvider()->block(1, rect, res, res);
-    block->convert(Qgis::Float32);
-    dtmCoarseData = block->data();
-    dtmCoarseData.detach();  // make a deep copy
-    delete block;
+    // may be called from multiple threads (e.g. loaders clamping features to the terrain).
+    // The data do not change once they are read, so they can be used without the lock afterwards
+    QMutexLocker locker(&dtmCoarseDataMutex);
+    if (dtmCoarseData.isEmpty())
+    {
+      // make a clone of the data provider - the original one may be used by another thread
+      std::unique_ptr<QgsRasterDataProvider> provider((QgsRasterDataProvider*)dtm->dataProvider()->clone());
+      std::unique_ptr<QgsRasterBlock> block(provider->block(1, rect, res, res));
+      if (block)
+      {
+        block->convert(Qgis::Float32);
+        dtmCoarseData = block->data();
+        dtmCoarseData.detach();  // make a deep copy
+      }
+    }
   }
 
+  if (dtmCoarseData.count() != res * res * (int)sizeof(float))
+    return 0;  // reading of the data failed
+
   int cellX = (int) ( (x - rect.xMinimum()) / rect.width() * res + .5f);
   int cellY = (int) ( (rect.yMaximum() - y) / rect.height() * res + .5f);
   cellX = qBound(0, cellX, res-1);
@@ -293,6 +498,38 @@ float DemHeightMapGenerator::heightAt(double x, double y)
   return data[cellX + cellY*res];
 }
 
+bool DemHeightMapGenerator::tileHeightRange(int x, int y, int z, float &hMin, float &hMax)
+{
+  if (!pyramidReady)
+  {
+    if (!pyramidFuture.isFinished())
+      return false;  // still being built
+    HeightRangePyramid pyramid = pyramidFuture.result();
+    heightMinPyramid = pyramid.min;
+    heightMaxPyramid = pyramid.max;
+    pyramidReady = true;   // if the build has failed, the pyramid stays empty (no more tries)
+  }
+  if (heightMinPyramid.isEmpty())
+    return false;
+
+  // tiles deeper than the pyramid use range of the deepest tile that contains them
+  int maxLevel = heightMinPyramid.count() - 1;
+  if (z > maxLevel)
+  {
+    x >>= z - maxLevel;
+    y >>= z - maxLevel;
+    z = maxLevel;
+  }
+
+  int n = 1 << z;
+  if (x < 0 || y < 0 || x >= n || y >= n)
+    return false;
+
+  hMin = heightMinPyramid[z][x + y*n];
+  hMax = heightMaxPyramid[z][x + y*n];
+  return hMin <= hMax;   // min > max if there are only no-data values
+}
+
 void DemHeightMapGenerator::onFutureFinished()
 {
   QFutureWatcher<QByteArray>* fw = static_cast<QFutureWatcher<QByteArray>*>(sender());
@@ -31,6 +31,7 @@ public:
   Type type() const override;
   QgsRectangle extent() const override;
   float heightAt(double x, double y, const Map3D &map) const override;
+  virtual bool tileHeightRange(int x, int y, int z, float& hMin, float& hMax) const override;
   virtual void writeXml(QDomElement& elem) const override;
   virtual void readXml(const QDomElement& elem) override;
   virtual void resolveReferences(const QgsProject& project) override;
@@ -51,6 +52,8 @@ private:
 
 #include <QtConcurrent/QtConcurrentRun>
 #include <QFutureWatcher>
+#include <QMutex>
+#include <QSharedPointer>
 
 #include "qgsrectangle.h"
 
@@ -72,9 +75,26 @@ public:
 
   int resolution() const { return res; }
 
-  //! returns height at given position (in terrain's CRS)
+  //! synchronous terrain read for a tile that also returns geometric error of the heightmap: max. height
+  //! difference between the heightmap and the data of the next finer level (in terrain's height units).
+  //! Both come from a single read of the finer data
+  QByteArray renderWithGeometricError(int x, int y, int z, float& error);
+
+  //! returns height at given position (in terrain's CRS). Can be called from any thread
   float heightAt(double x, double y);
 
+  //! returns min/max height of a tile using precomputed height range pyramid (built in background when
+  //! the generator gets created). Returns false if the range is not known (the pyramid is not ready yet,
+  //! its build has failed or the tile only covers no-data area). Should be called from the main thread
+  bool tileHeightRange(int x, int y, int z, float& hMin, float& hMax);
+
+  //! min/max heights for tiles: index of the vector is the zoom level,
+  //! at zoom level Z there are (2^Z)^2 tiles stored row by row starting with tile [0,0]
+  struct HeightRangePyramid
+  {
+    QVector< QVector<float> > min, max;
+  };
+
 signals:
   //! emitted when a previously requested heightmap is ready
   void heightMapReady(int jobId, const QByteArray& heightMap);
@@ -104,6 +124,14 @@ private:
 
   //! used for height queries
   QByteArray dtmCoarseData;
+  //! guards the lazy initialization of dtmCoarseData
+  QMutex dtmCoarseDataMutex;
+
+  //! min/max heights for tiles (see HeightRangePyramid), empty until the build has finished
+  QVector< QVector<float> > heightMinPyramid, heightMaxPyramid;
+  QFuture<HeightRangePyramid> pyramidFuture;
+  bool pyramidReady;   //!< whether the result of the build has been taken (even if it failed)
+  QSharedPointer<QAtomicInt> pyramidCancelled;  //!< set when the generator is gone before the build has finished
 };
 
 #endif // DEMTERRAINGENERATOR_H
@@ -2,22 +2,34 @@
 
 #include "polygongeometry.h"
 #include "map3d.h"
+#include "tessellationcache.h"
 #include "terraingenerator.h"
 #include "utils.h"
 
 #include <Qt3DExtras/QPhongMaterial>
 #include <Qt3DRender/QGeometryRenderer>
 
+#include "qgslinestring.h"
+#include "qgsmulticurve.h"
 #include "qgsvectorlayer.h"
-#include "qgsmultipolygon.h"
-#include "qgsgeos.h"
 
 
+//! lines are drawn as ribbons generated directly from their vertices (much cheaper than buffering
+//! them to polygons and triangulating those), each vertex is clamped on its own
+static void _addLine(Tessellator& tessellator, const QgsCurve* curve, const QgsPoint& centroid, const LineRenderer& settings, const Map3D& map)
+{
+  QgsLineString* lineString = curve->curveToLine();  // curved geometries get segmentized
+  if (!lineString->is3D())
+    lineString->addZValue(0);
+  Utils::clampAltitudes(lineString, settings.altClamping, settings.altBinding, centroid, settings.height, map);
+  tessellator.addLineString(*lineString, 2 * settings.distance, settings.extrusionHeight);
+  delete lineString;
+}
+
 LineEntity::LineEntity(const Map3D &map, const LineRenderer &settings, Qt3DCore::QNode *parent)
   : Qt3DCore::QEntity(parent)
 {
   QgsVectorLayer* layer = settings.layer();
-  QgsPointXY origin(map.originX, map.originY);
 
   Qt3DExtras::QPhongMaterial* material = new Qt3DExtras::QPhongMaterial;
   material->setAmbient(settings.material.ambient());
@@ -26,13 +38,14 @@ LineEntity::LineEntity(const Map3D &map, const LineRenderer &settings, Qt3DCore:
   material->setShininess(settings.material.shininess());
   addComponent(material);
 
-  // TODO: configurable
-  int nSegments = 4;
-  QgsGeometry::EndCapStyle endCapStyle = QgsGeometry::CapRound;
-  QgsGeometry::JoinStyle joinStyle = QgsGeometry::JoinStyleRound;
-  double mitreLimit = 0;
+  geometry = new PolygonGeometry;
+
+  // features that have not changed since the last time are taken from the cache as they are,
+  // only the others get clamped and turned into ribbons
+  TessellationCache cache(TessellationCache::defaultDirectory(), TessellationCache::lineRendererKey(map, settings));
+  QVector<TessellatedMesh> meshes;
+  Tessellator tessellator(map.originX, map.originY, true);
 
-  QList<QgsPolygon*> polygons;
   QgsFeature f;
   QgsFeatureRequest request;
   request.setDestinationCrs(map.crs, QgsCoordinateTransformContext());
@@ -42,34 +55,41 @@ LineEntity::LineEntity(const Map3D &map, const LineRenderer &settings, Qt3DCore:
     if (f.geometry().isNull())
       continue;
 
+    QByteArray geometryHash = TessellationCache::geometryHash(f.geometry());
+    TessellatedMesh mesh;
+    if (cache.mesh(f.id(), geometryHash, mesh))
+    {
+      meshes << mesh;
+      continue;
+    }
+
     const QgsAbstractGeometry* g = f.geometry().constGet();
 
-    QgsGeos engine(g);
-    QgsAbstractGeometry *buffered = engine.buffer(settings.distance, nSegments, endCapStyle, joinStyle, mitreLimit);  // factory
+    QgsPoint centroid;
+    if (settings.altBinding == AltBindCentroid)
+      centroid = g->centroid();
 
-    if (QgsWkbTypes::flatType(buffered->wkbType()) == QgsWkbTypes::Polygon)
+    if (const QgsCurve* curve = dynamic_cast<const QgsCurve*>(g))
     {
-      QgsPolygon* polyBuffered = static_cast<QgsPolygon*>(buffered);
-      Utils::clampAltitudes(polyBuffered, settings.altClamping, settings.altBinding, settings.height, map);
-      polygons.append(polyBuffered);
+      _addLine(tessellator, curve, centroid, settings, map);
     }
-    else if (QgsWkbTypes::flatType(buffered->wkbType()) == QgsWkbTypes::MultiPolygon)
+    else if (const QgsMultiCurve* mcurve = dynamic_cast<const QgsMultiCurve*>(g))
     {
-      QgsMultiPolygon* mpolyBuffered = static_cast<QgsMultiPolygon*>(buffered);
-      for (int i = 0; i < mpolyBuffered->numGeometries(); ++i)
-      {
-        QgsAbstractGeometry* partBuffered = mpolyBuffered->geometryN(i);
-        Q_ASSERT(QgsWkbTypes::flatType(partBuffered->wkbType()) == QgsWkbTypes::Polygon);
-        QgsPolygon* polyBuffered = static_cast<QgsPolygon*>(partBuffered)->clone();   // need to clone individual geometry parts
-        Utils::clampAltitudes(polyBuffered, settings.altClamping, settings.altBinding, settings.height, map);
-        polygons.append(polyBuffered);
-      }
-      delete buffered;
+      for (int i = 0; i < mcurve->numGeometries(); ++i)
+        _addLine(tessellator, static_cast<const QgsCurve*>(mcurve->geometryN(i)), centroid, settings, map);
     }
+
+    mesh.data = tessellator.data;
+    mesh.indices = tessellator.indices;
+    tessellator.data.clear();
+    tessellator.indices.clear();
+
+    cache.addMesh(f.id(), geometryHash, mesh);
+    meshes << mesh;
   }
+  cache.save();
 
-  geometry = new PolygonGeometry;
-  geometry->setPolygons(polygons, origin, /*settings.height,*/ settings.extrusionHeight);
+  geometry->setMeshes(meshes);
 
   Qt3DRender::QGeometryRenderer* renderer = new Qt3DRender::QGeometryRenderer;
   renderer->setGeometry(geometry);
@@ -128,46 +128,46 @@ int main(int argc, char *argv[])
 
   // points
 
+  // trees: trunk and crown are parts of one symbol, so the layer is read and clamped just once
   PointRenderer ptr;
   ptr.setLayer(vlPoints);
-  ptr.material.setDiffuse(QColor(222,184,135));
-  ptr.material.setAmbient(ptr.material.diffuse().darker());
-  ptr.material.setShininess(0);
-  ptr.height = 2.5;
-  ptr.shapeProperties["shape"] = "cylinder";
-  ptr.shapeProperties["radius"] = 1;
-  ptr.shapeProperties["length"] = 5;
-  //Qt3DCore::QTransform tr;
-  //tr.setScale3D(QVector3D(4,1,4));
-  //ptr.transform = tr.matrix();
-  map.pointRenderers << ptr;
-
-  PointRenderer ptr2;
-  ptr2.setLayer(vlPoints);
-  ptr2.material.setDiffuse(QColor(60,179,113));
-  ptr2.material.setAmbient(ptr2.material.diffuse().darker());
-  ptr2.material.setShininess(0);
-  ptr2.height = 7.5;
-  ptr2.shapeProperties["shape"] = "sphere";
-  ptr2.shapeProperties["radius"] = 3.5;
-  map.pointRenderers << ptr2;
+  ptr.height = 0;
+  ptr.billboardDistance = 500;
+
+  PointSymbolPart trunk;
+  trunk.material.setDiffuse(QColor(222,184,135));
+  trunk.material.setAmbient(trunk.material.diffuse().darker());
+  trunk.material.setShininess(0);
+  trunk.shapeProperties["shape"] = "cylinder";
+  trunk.shapeProperties["radius"] = 1;
+  trunk.shapeProperties["length"] = 5;
+  trunk.transform.translate(0, 2.5, 0);
+  //trunk.transform.scale(4,1,4);
+  ptr.parts << trunk;
+
+  PointSymbolPart crown;
+  crown.material.setDiffuse(QColor(60,179,113));
+  crown.material.setAmbient(crown.material.diffuse().darker());
+  crown.material.setShininess(0);
+  crown.shapeProperties["shape"] = "sphere";
+  crown.shapeProperties["radius"] = 3.5;
+  crown.transform.translate(0, 7.5, 0);
+  ptr.parts << crown;
 
 #if 0
   // Q on top of trees - only in Qt 5.9
-  PointRenderer ptr3;
-  ptr3.setLayer(vlPoints);
-  ptr3.material.setDiffuse(QColor(88, 150, 50));
-  ptr3.material.setAmbient(ptr3.material.diffuse().darker());
-  ptr3.height = 25;
-  ptr3.shapeProperties["shape"] = "extrudedText";
-  ptr3.shapeProperties["text"] = "Q";
-  Qt3DCore::QTransform tr;
-  tr.setScale3D(QVector3D(3,3,3));
-  tr.setTranslation(QVector3D(-4,0,0));
-  ptr3.transform = tr.matrix();
-  map.pointRenderers << ptr3;
+  PointSymbolPart text;
+  text.material.setDiffuse(QColor(88, 150, 50));
+  text.material.setAmbient(text.material.diffuse().darker());
+  text.shapeProperties["shape"] = "extrudedText";
+  text.shapeProperties["text"] = "Q";
+  text.transform.translate(-4, 25, 0);
+  text.transform.scale(3, 3, 3);
+  ptr.parts << text;
 #endif
 
+  map.pointRenderers << ptr;
+
   // lines
 
   LineRenderer lr;
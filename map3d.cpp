@@ -79,6 +79,9 @@ Map3D::Map3D()
   , backgroundColor(Qt::black)
   , zExaggeration(1)
   , tileTextureSize(512)
+  , parallelTextureRendering(false)
+  , compressTerrainTextures(false)
+  , terrainTextureArrays(false)
   , maxTerrainError(3.f)
   , skybox(false)
   , showBoundingBoxes(false)
@@ -101,6 +104,9 @@ void Map3D::readXml(const QDomElement &elem, const QgsReadWriteContext &context)
   QDomElement elemTerrain = elem.firstChildElement("terrain");
   zExaggeration = elemTerrain.attribute("exaggeration", "1").toFloat();
   tileTextureSize = elemTerrain.attribute("texture-size", "512").toInt();
+  parallelTextureRendering = elemTerrain.attribute("parallel-texture-rendering", "0").toInt();
+  compressTerrainTextures = elemTerrain.attribute("texture-compression", "0").toInt();
+  terrainTextureArrays = elemTerrain.attribute("texture-arrays", "0").toInt();
   maxTerrainError = elemTerrain.attribute("max-terrain-error", "3").toFloat();
   QDomElement elemMapLayers = elemTerrain.firstChildElement("layers");
   QDomElement elemMapLayer = elemMapLayers.firstChildElement("layer");
@@ -186,6 +192,9 @@ QDomElement Map3D::writeXml(QDomDocument &doc, const QgsReadWriteContext &contex
   QDomElement elemTerrain = doc.createElement("terrain");
   elemTerrain.setAttribute("exaggeration", QString::number(zExaggeration));
   elemTerrain.setAttribute("texture-size", tileTextureSize);
+  elemTerrain.setAttribute("parallel-texture-rendering", parallelTextureRendering ? 1 : 0);
+  elemTerrain.setAttribute("texture-compression", compressTerrainTextures ? 1 : 0);
+  elemTerrain.setAttribute("texture-arrays", terrainTextureArrays ? 1 : 0);
   elemTerrain.setAttribute("max-terrain-error", QString::number(maxTerrainError));
   QDomElement elemMapLayers = doc.createElement("layers");
   Q_FOREACH (const QgsMapLayerRef& layerRef, mLayers)
@@ -299,6 +308,7 @@ PolygonRenderer::PolygonRenderer()
   , altBinding(AltBindCentroid)
   , height(0)
   , extrusionHeight(0)
+  , tiled(false)
 {
 }
 
@@ -322,6 +332,7 @@ void PolygonRenderer::writeXml(QDomElement &elem) const
   elemDataProperties.setAttribute("alt-binding", altBindingToString(altBinding));
   elemDataProperties.setAttribute("height", height);
   elemDataProperties.setAttribute("extrusion-height", extrusionHeight);
+  elemDataProperties.setAttribute("tiled", tiled ? 1 : 0);
   elem.appendChild(elemDataProperties);
 
   QDomElement elemMaterial = doc.createElement("material");
@@ -337,6 +348,7 @@ void PolygonRenderer::readXml(const QDomElement &elem)
   altBinding = altBindingFromString(elemDataProperties.attribute("alt-binding"));
   height = elemDataProperties.attribute("height").toFloat();
   extrusionHeight = elemDataProperties.attribute("extrusion-height").toFloat();
+  tiled = elemDataProperties.attribute("tiled", "0").toInt();
 
   QDomElement elemMaterial = elem.firstChildElement("material");
   material.readXml(elemMaterial);
@@ -349,8 +361,40 @@ void PolygonRenderer::resolveReferences(const QgsProject &project)
 
 // ---------------
 
+void PointSymbolPart::writeXml(QDomElement &elem) const
+{
+  QDomDocument doc = elem.ownerDocument();
+
+  QDomElement elemMaterial = doc.createElement("material");
+  material.writeXml(elemMaterial);
+  elem.appendChild(elemMaterial);
+
+  QDomElement elemShapeProperties = doc.createElement("shape-properties");
+  elemShapeProperties.appendChild(QgsXmlUtils::writeVariant(shapeProperties, doc));
+  elem.appendChild(elemShapeProperties);
+
+  QDomElement elemTransform = doc.createElement("transform");
+  elemTransform.setAttribute("matrix", _matrix4x4toString(transform));
+  elem.appendChild(elemTransform);
+}
+
+void PointSymbolPart::readXml(const QDomElement &elem)
+{
+  QDomElement elemMaterial = elem.firstChildElement("material");
+  material.readXml(elemMaterial);
+
+  QDomElement elemShapeProperties = elem.firstChildElement("shape-properties");
+  shapeProperties = QgsXmlUtils::readVariant(elemShapeProperties.firstChildElement()).toMap();
+
+  QDomElement elemTransform = elem.firstChildElement("transform");
+  transform = _stringToMatrix4x4(elemTransform.attribute("matrix"));
+}
+
+// ---------------
+
 PointRenderer::PointRenderer()
   : height(0)
+  , billboardDistance(0)
 {
 }
 
@@ -371,19 +415,17 @@ void PointRenderer::writeXml(QDomElement &elem) const
   QDomElement elemDataProperties = doc.createElement("data");
   elemDataProperties.setAttribute("layer", layerRef.layerId);
   elemDataProperties.setAttribute("height", height);
+  elemDataProperties.setAttribute("billboard-distance", billboardDistance);
   elem.appendChild(elemDataProperties);
 
-  QDomElement elemMaterial = doc.createElement("material");
-  material.writeXml(elemMaterial);
-  elem.appendChild(elemMaterial);
-
-  QDomElement elemShapeProperties = doc.createElement("shape-properties");
-  elemShapeProperties.appendChild(QgsXmlUtils::writeVariant(shapeProperties, doc));
-  elem.appendChild(elemShapeProperties);
-
-  QDomElement elemTransform = doc.createElement("transform");
-  elemTransform.setAttribute("matrix", _matrix4x4toString(transform));
-  elem.appendChild(elemTransform);
+  QDomElement elemParts = doc.createElement("parts");
+  Q_FOREACH (const PointSymbolPart& part, parts)
+  {
+    QDomElement elemPart = doc.createElement("part");
+    part.writeXml(elemPart);
+    elemParts.appendChild(elemPart);
+  }
+  elem.appendChild(elemParts);
 }
 
 void PointRenderer::readXml(const QDomElement &elem)
@@ -391,15 +433,28 @@ void PointRenderer::readXml(const QDomElement &elem)
   QDomElement elemDataProperties = elem.firstChildElement("data");
   layerRef = QgsMapLayerRef(elemDataProperties.attribute("layer"));
   height = elemDataProperties.attribute("height").toFloat();
+  billboardDistance = elemDataProperties.attribute("billboard-distance", "0").toFloat();
 
-  QDomElement elemMaterial = elem.firstChildElement("material");
-  material.readXml(elemMaterial);
-
-  QDomElement elemShapeProperties = elem.firstChildElement("shape-properties");
-  shapeProperties = QgsXmlUtils::readVariant(elemShapeProperties.firstChildElement()).toMap();
-
-  QDomElement elemTransform = elem.firstChildElement("transform");
-  transform = _stringToMatrix4x4(elemTransform.attribute("matrix"));
+  parts.clear();
+  QDomElement elemParts = elem.firstChildElement("parts");
+  if (elemParts.isNull())
+  {
+    // older projects have a single shape stored directly in the renderer's element
+    PointSymbolPart part;
+    part.readXml(elem);
+    parts << part;
+  }
+  else
+  {
+    QDomElement elemPart = elemParts.firstChildElement("part");
+    while (!elemPart.isNull())
+    {
+      PointSymbolPart part;
+      part.readXml(elemPart);
+      parts << part;
+      elemPart = elemPart.nextSiblingElement("part");
+    }
+  }
 }
 
 void PointRenderer::resolveReferences(const QgsProject &project)
@@ -89,11 +89,24 @@ public:
   float height;           //!< base height of polygons
   float extrusionHeight;  //!< how much to extrude (0 means no walls)
   PhongMaterialSettings material;  //!< defines appearance of objects
+  bool tiled;             //!< whether polygons are loaded by tiles with level of detail (for layers with many features)
 
 private:
   QgsMapLayerRef layerRef; //!< layer used to extract polygons from
 };
 
+//! One part of a point symbol: a shape with its own material, placed relative to the point by the transform
+class PointSymbolPart
+{
+public:
+  void writeXml(QDomElement& elem) const;
+  void readXml(const QDomElement& elem);
+
+  PhongMaterialSettings material;  //!< defines appearance of objects
+  QVariantMap shapeProperties;  //!< what kind of shape to use and what
+  QMatrix4x4 transform;  //!< transform of individual instanced models
+};
+
 class PointRenderer
 {
 public:
@@ -107,9 +120,8 @@ public:
   void resolveReferences(const QgsProject& project);
 
   float height;
-  PhongMaterialSettings material;  //!< defines appearance of objects
-  QVariantMap shapeProperties;  //!< what kind of shape to use and what
-  QMatrix4x4 transform;  //!< transform of individual instanced models
+  QList<PointSymbolPart> parts;  //!< shapes drawn at each point (the layer is read just once for all of them)
+  float billboardDistance;  //!< instances further from the camera are drawn as billboards (0 = always full geometry)
 
 private:
   QgsMapLayerRef layerRef; //!< layer used to extract points from
@@ -134,7 +146,7 @@ public:
   float extrusionHeight;  //!< how much to extrude (0 means no walls)
   PhongMaterialSettings material;  //!< defines appearance of objects
 
-  float distance;  //!< distance of buffer of lines
+  float distance;  //!< half of the width of lines
 
 private:
   QgsMapLayerRef layerRef; //!< layer used to extract points from
@@ -171,6 +183,9 @@ public:
   QList<QgsMapLayer*> layers() const;
 
   int tileTextureSize;   //!< size of map textures of tiles in pixels (width/height)
+  bool parallelTextureRendering;  //!< whether map textures of multiple tiles are rendered at once in a thread pool (layers get cloned for each tile)
+  bool compressTerrainTextures;  //!< whether map textures are compressed (BC1) before upload - uses 8x less GPU memory
+  bool terrainTextureArrays;  //!< whether map textures of tiles are stored in shared texture arrays (fewer material switches)
   int maxTerrainError;   //!< maximum allowed terrain error in pixels
   std::unique_ptr<TerrainGenerator> terrainGenerator;  //!< implementation of the terrain generation
 
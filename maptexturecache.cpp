@@ -0,0 +1,290 @@
+#include "maptexturecache.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QTextStream>
+#include <QtConcurrent/QtConcurrentRun>
+
+#include "qgsmaplayer.h"
+#include "qgsmaplayerstylemanager.h"
+#include "qgsmapsettings.h"
+
+
+static QString _hash(const QByteArray& data)
+{
+  return QString::fromLatin1(QCryptographicHash::hash(data, QCryptographicHash::Sha1).toHex());
+}
+
+//! suffix of directories with invalidated tiles that are waiting to be deleted
+static const char* REMOVED_SUFFIX = ".removed-";
+
+static void _removeDirectoryInBackground(const QString& path)
+{
+  QtConcurrent::run([path] { QDir(path).removeRecursively(); });
+}
+
+
+MapTextureCache::MapTextureCache(const QString &directory, int memoryLimitKB, qint64 diskLimitKB)
+  : mMemory(memoryLimitKB)
+  , mLastUse(0)
+  , mDiskUsage(0)
+  , mDiskLimit(diskLimitKB * 1024)
+  , mDirectory(directory)
+{
+  QDir().mkpath(mDirectory);
+
+  // find out what is on disk already, the least recently written tiles will be evicted first
+  Q_FOREACH (const QFileInfo& dirInfo, QDir(mDirectory).entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot))
+  {
+    if (dirInfo.fileName().contains(REMOVED_SUFFIX))
+    {
+      _removeDirectoryInBackground(dirInfo.filePath());  // left over from the last run
+      continue;
+    }
+
+    QDirIterator it(dirInfo.filePath(), QStringList("*.png"), QDir::Files);
+    while (it.hasNext())
+    {
+      it.next();
+      QFileInfo fi = it.fileInfo();
+      QString key = dirInfo.fileName() + '/' + fi.completeBaseName();
+      qint64 lastUse = fi.lastModified().toMSecsSinceEpoch();
+      mDiskTiles.insert(key, DiskTile{fi.size(), lastUse});
+      mDiskLru.insert(lastUse, key);
+      mDiskUsage += fi.size();
+      mLastUse = qMax(mLastUse, lastUse);
+    }
+  }
+
+  evictDiskTiles();
+}
+
+QString MapTextureCache::tileKey(const QgsMapSettings &mapSettings)
+{
+  const QgsRectangle& r = mapSettings.extent();
+  QString str = QString("%1 %2 %3 %4|%5x%6|%7|%8")
+      .arg(r.xMinimum(), 0, 'g', 17).arg(r.yMinimum(), 0, 'g', 17)
+      .arg(r.xMaximum(), 0, 'g', 17).arg(r.yMaximum(), 0, 'g', 17)
+      .arg(mapSettings.outputSize().width()).arg(mapSettings.outputSize().height())
+      .arg(mapSettings.destinationCrs().toWkt())
+      .arg(mapSettings.backgroundColor().name(QColor::HexArgb));
+  return _hash(str.toUtf8());
+}
+
+QString MapTextureCache::layersKey(const QList<QgsMapLayer *> &layers)
+{
+  QByteArray data;
+  Q_FOREACH (QgsMapLayer* layer, layers)
+  {
+    QgsMapLayerStyle style;
+    style.readFromLayer(layer);
+    data += layer->id().toUtf8() + '\n';
+    data += layer->source().toUtf8() + '\n';
+    data += style.xmlData().toUtf8() + '\n';
+  }
+  return _hash(data);
+}
+
+bool MapTextureCache::tile(const QString &layersKey, const QString &tileKey, QImage &image)
+{
+  const QString key = layersKey + '/' + tileKey;
+  {
+    QMutexLocker locker(&mMutex);
+    if (QImage* img = mMemory.object(key))
+    {
+      image = *img;
+      return true;
+    }
+  }
+
+  QImage img;
+  if (!img.load(tilePath(layersKey, tileKey), "PNG"))
+    return false;
+
+  // keep it in memory for the next time
+  QMutexLocker locker(&mMutex);
+  mMemory.insert(key, new QImage(img), img.byteCount() / 1024);
+  auto it = mDiskTiles.constFind(key);
+  if (it != mDiskTiles.constEnd())
+    touchDiskTile(key, it->size);
+  image = img;
+  return true;
+}
+
+void MapTextureCache::addTile(const QString &layersKey, const QString &tileKey, const QgsRectangle &extent, const QImage &image)
+{
+  {
+    QMutexLocker locker(&mMutex);
+    mMemory.insert(layersKey + '/' + tileKey, new QImage(image), image.byteCount() / 1024);
+  }
+
+  // write to a temporary file first so that readers never see a partially written tile
+  QString path = tilePath(layersKey, tileKey);
+  QDir().mkpath(QFileInfo(path).path());
+  QSaveFile file(path);
+  if (!file.open(QIODevice::WriteOnly) || !image.save(&file, "PNG"))
+  {
+    qDebug() << "failed to write map texture tile" << path;
+    return;
+  }
+  qint64 fileSize = file.size();
+  if (!file.commit())
+  {
+    qDebug() << "failed to write map texture tile" << path;
+    return;
+  }
+
+  QMutexLocker locker(&mMutex);
+  touchDiskTile(layersKey + '/' + tileKey, fileSize);
+  evictDiskTiles();
+
+  // record the extent: one line "<tile key> <xmin> <ymin> <xmax> <ymax>" per tile
+  QHash<QString, QgsRectangle>& extents = tileExtents(layersKey);
+  if (extents.contains(tileKey))
+    return;
+  extents.insert(tileKey, extent);
+  QFile extentsFile(extentsPath(layersKey));
+  if (extentsFile.open(QIODevice::Append | QIODevice::Text))
+  {
+    QTextStream stream(&extentsFile);
+    stream.setRealNumberPrecision(17);
+    stream << tileKey << ' ' << extent.xMinimum() << ' ' << extent.yMinimum() << ' ' << extent.xMaximum() << ' ' << extent.yMaximum() << '\n';
+  }
+}
+
+void MapTextureCache::removeTiles(const QString &layersKey, const QgsRectangle &extent)
+{
+  QMutexLocker locker(&mMutex);
+  const QString prefix = layersKey + '/';
+
+  if (extent.isNull())
+  {
+    Q_FOREACH (const QString& key, mMemory.keys())
+    {
+      if (key.startsWith(prefix))
+        mMemory.remove(key);
+    }
+    Q_FOREACH (const QString& key, mDiskTiles.keys())
+    {
+      if (key.startsWith(prefix))
+        forgetDiskTile(key);
+    }
+    mExtents.remove(layersKey);
+
+    // deleting many files may take a while - move them out of the way and delete them in background
+    QString dirPath = mDirectory + '/' + layersKey;
+    QString removedPath = dirPath + REMOVED_SUFFIX + QString::number(QDateTime::currentMSecsSinceEpoch());
+    if (QDir().rename(dirPath, removedPath))
+      _removeDirectoryInBackground(removedPath);
+    else if (QFileInfo(dirPath).exists())
+    {
+      qDebug() << "failed to rename map texture tiles directory" << dirPath;
+      QDir(dirPath).removeRecursively();
+    }
+    return;
+  }
+
+  QHash<QString, QgsRectangle>& extents = tileExtents(layersKey);
+  for (auto it = extents.begin(); it != extents.end(); )
+  {
+    // symbols may reach a bit further than geometries of features
+    if (it.value().buffered(it.value().width() * 0.1).intersects(extent))
+    {
+      mMemory.remove(prefix + it.key());
+      forgetDiskTile(prefix + it.key());
+      QFile::remove(tilePath(layersKey, it.key()));
+      it = extents.erase(it);
+    }
+    else
+      ++it;
+  }
+
+  // memory may also hold tiles that failed to be written to disk
+  Q_FOREACH (const QString& key, mMemory.keys())
+  {
+    if (key.startsWith(prefix) && !extents.contains(key.mid(prefix.length())))
+      mMemory.remove(key);
+  }
+
+  // rewrite the list of extents without the removed tiles
+  QSaveFile extentsFile(extentsPath(layersKey));
+  if (extentsFile.open(QIODevice::WriteOnly | QIODevice::Text))
+  {
+    QTextStream stream(&extentsFile);
+    stream.setRealNumberPrecision(17);
+    for (auto it = extents.constBegin(); it != extents.constEnd(); ++it)
+      stream << it.key() << ' ' << it.value().xMinimum() << ' ' << it.value().yMinimum() << ' ' << it.value().xMaximum() << ' ' << it.value().yMaximum() << '\n';
+    stream.flush();
+    extentsFile.commit();
+  }
+}
+
+QString MapTextureCache::tilePath(const QString &layersKey, const QString &tileKey) const
+{
+  return QString("%1/%2/%3.png").arg(mDirectory, layersKey, tileKey);
+}
+
+QString MapTextureCache::extentsPath(const QString &layersKey) const
+{
+  return QString("%1/%2/extents.txt").arg(mDirectory, layersKey);
+}
+
+void MapTextureCache::touchDiskTile(const QString &key, qint64 size)
+{
+  // must be called with the mutex locked
+  forgetDiskTile(key);
+  mLastUse = qMax(QDateTime::currentMSecsSinceEpoch(), mLastUse + 1);
+  mDiskTiles.insert(key, DiskTile{size, mLastUse});
+  mDiskLru.insert(mLastUse, key);
+  mDiskUsage += size;
+}
+
+void MapTextureCache::forgetDiskTile(const QString &key)
+{
+  // must be called with the mutex locked
+  auto it = mDiskTiles.find(key);
+  if (it == mDiskTiles.end())
+    return;
+  mDiskLru.remove(it->lastUse, key);
+  mDiskUsage -= it->size;
+  mDiskTiles.erase(it);
+}
+
+void MapTextureCache::evictDiskTiles()
+{
+  // must be called with the mutex locked
+  while (mDiskUsage > mDiskLimit && !mDiskLru.isEmpty())
+  {
+    QString key = mDiskLru.first();
+    forgetDiskTile(key);
+    // the tile stays listed in extents - that only means it may get invalidated needlessly
+    QFile::remove(mDirectory + '/' + key + ".png");
+  }
+}
+
+QHash<QString, QgsRectangle> &MapTextureCache::tileExtents(const QString &layersKey)
+{
+  // must be called with the mutex locked
+  auto it = mExtents.find(layersKey);
+  if (it != mExtents.end())
+    return it.value();
+
+  QHash<QString, QgsRectangle> extents;
+  QFile file(extentsPath(layersKey));
+  if (file.open(QIODevice::ReadOnly | QIODevice::Text))
+  {
+    QTextStream stream(&file);
+    while (!stream.atEnd())
+    {
+      QStringList parts = stream.readLine().split(' ');
+      if (parts.count() == 5)
+        extents.insert(parts[0], QgsRectangle(parts[1].toDouble(), parts[2].toDouble(), parts[3].toDouble(), parts[4].toDouble()));
+    }
+  }
+  return mExtents.insert(layersKey, extents).value();
+}
@@ -0,0 +1,79 @@
+#ifndef MAPTEXTURECACHE_H
+#define MAPTEXTURECACHE_H
+
+#include <QCache>
+#include <QHash>
+#include <QImage>
+#include <QMap>
+#include <QMutex>
+
+#include "qgsrectangle.h"
+
+class QgsMapLayer;
+class QgsMapSettings;
+
+/**
+ * Cache of rendered map texture tiles. Recently used tiles are kept in memory, all tiles are also
+ * stored as PNG files on disk. Both in memory and on disk there is a limit - least recently used
+ * tiles get evicted when over the limit.
+ * Tiles are grouped by a key of the rendered layers (and their styles) so that when
+ * the layers change, their tiles can be dropped together. Extents of tiles are recorded
+ * as well, so that only tiles in an area affected by a change of data can be dropped.
+ *
+ * The class is thread-safe.
+ */
+class MapTextureCache
+{
+public:
+  //! Creates cache storing files in the given directory, memory and disk limits are in kilobytes.
+  //! Scans the directory for tiles stored previously
+  MapTextureCache(const QString& directory, int memoryLimitKB = 64*1024, qint64 diskLimitKB = 1024*1024);
+
+  //! Returns key of a tile rendered with the map settings (extent, output size, CRS, background color)
+  static QString tileKey(const QgsMapSettings& mapSettings);
+
+  //! Returns key of the list of layers including their sources and styles. Should be called from the main thread
+  static QString layersKey(const QList<QgsMapLayer*>& layers);
+
+  //! Looks up a tile in memory, then on disk. Returns false if the tile is not cached
+  bool tile(const QString& layersKey, const QString& tileKey, QImage& image);
+
+  //! Stores a tile (rendered for the given map extent) in memory and on disk
+  void addTile(const QString& layersKey, const QString& tileKey, const QgsRectangle& extent, const QImage& image);
+
+  //! Removes tiles of the given layers key from memory and from disk. If the extent is not null,
+  //! only tiles intersecting the extent are removed, otherwise all tiles of the layers key are removed
+  //! (their directory is renamed and deleted in background)
+  void removeTiles(const QString& layersKey, const QgsRectangle& extent = QgsRectangle());
+
+private:
+  QString tilePath(const QString& layersKey, const QString& tileKey) const;
+  QString extentsPath(const QString& layersKey) const;
+  QHash<QString, QgsRectangle>& tileExtents(const QString& layersKey);
+
+  //! Information about a tile file on disk
+  struct DiskTile
+  {
+    qint64 size;      //!< file size in bytes
+    qint64 lastUse;   //!< key in the LRU list
+  };
+
+  //! Records a tile file on disk (or updates its size) and marks it as most recently used
+  void touchDiskTile(const QString& key, qint64 size);
+  //! Forgets a tile file on disk (does not remove the file)
+  void forgetDiskTile(const QString& key);
+  //! Removes least recently used tile files until the disk usage is within the limit
+  void evictDiskTiles();
+
+  QMutex mMutex;
+  QCache<QString, QImage> mMemory;   //!< key is "<layersKey>/<tileKey>", cost is in kilobytes
+  QHash<QString, QHash<QString, QgsRectangle> > mExtents;  //!< extents of tiles on disk (loaded on demand for each layers key)
+  QHash<QString, DiskTile> mDiskTiles;     //!< key is "<layersKey>/<tileKey>"
+  QMultiMap<qint64, QString> mDiskLru;     //!< keys of tiles on disk ordered from the least recently used
+  qint64 mLastUse;      //!< time of last use (milliseconds since epoch, kept strictly increasing)
+  qint64 mDiskUsage;    //!< total size of tile files on disk in bytes
+  qint64 mDiskLimit;    //!< in bytes
+  QString mDirectory;
+};
+
+#endif // MAPTEXTURECACHE_H
@@ -1,31 +1,157 @@
 #include "maptexturegenerator.h"
 
+#include <QMutex>
+#include <QRunnable>
+#include <QStandardPaths>
+#include <QWaitCondition>
+
+#include <qgsmaplayer.h>
 #include <qgsmaprenderersequentialjob.h>
 #include <qgsmapsettings.h>
 #include <qgsproject.h>
+#include <qgsvectorlayer.h>
 
 #include "map3d.h"
+#include "maptexturecache.h"
+
+
+//! extra tile information for debugging
+static void _drawDebugText(QImage& img, const QString& debugText)
+{
+  if (debugText.isEmpty())
+    return;
+
+  QPainter p(&img);
+  p.setPen(Qt::white);
+  p.drawRect(0,0,img.width()-1, img.height()-1);
+  p.drawText(img.rect(), debugText, QTextOption(Qt::AlignCenter));
+  p.end();
+}
+
+
+//! Shared state of a tile requested by MapTextureGenerator::requestTile()
+struct MapTextureRequest
+{
+  enum State
+  {
+    Queued,     //!< waiting in the thread pool's queue
+    Rendering,  //!< being rendered by a pool thread, by the thread waiting for it or by a job in the main thread
+    Finished,   //!< image is available
+    Cancelled,  //!< dropped before the image has been rendered
+  };
+
+  QgsMapSettings mapSettings;   //!< snapshot taken in the main thread (layers get replaced by clones when rendering)
+  QString layersKey;
+  int cacheGeneration;
+  QString debugText;
+  QgsMapRendererSequentialJob* job = nullptr;  //!< job rendering the tile in the main thread (only used there)
+
+  QMutex mutex;
+  QWaitCondition finished;
+  State state;
+  QImage image;
+};
+
+
+//! Copies of map layers (with their own data providers) that are used by one thread at a time
+struct MapTextureLayerClones
+{
+  QList<QgsMapLayer*> layers;
+  int version;   //!< clones of an older version get deleted instead of being reused
+};
+
+//! clones were created in the main thread - get them deleted there
+static void _deleteLayerClones(MapTextureLayerClones* clones)
+{
+  Q_FOREACH (QgsMapLayer* layer, clones->layers)
+    layer->deleteLater();
+  delete clones;
+}
+
+//! Whether some of the layers have uncommitted edits - clones would only see the data source
+static bool _hasEditBuffer(const QList<QgsMapLayer*>& layers)
+{
+  Q_FOREACH (QgsMapLayer* layer, layers)
+  {
+    QgsVectorLayer* vlayer = qobject_cast<QgsVectorLayer*>(layer);
+    if (vlayer && vlayer->isEditable() && vlayer->isModified())
+      return true;
+  }
+  return false;
+}
+
+
+//! Renders a requested tile in the thread pool (unless somebody else has taken it already)
+class MapTextureRenderTask : public QRunnable
+{
+public:
+  MapTextureRenderTask(MapTextureGenerator* generator, const MapTextureRequestPtr& request)
+    : generator(generator), request(request) {}
+
+  void run() override
+  {
+    generator->renderRequest(request);
+  }
+
+private:
+  MapTextureGenerator* generator;
+  MapTextureRequestPtr request;
+};
+
 
 MapTextureGenerator::MapTextureGenerator(const Map3D& map)
   : map(map)
+  , cacheGeneration(0)
   , lastJobId(0)
+  , clonesVersion(0)
+  , clonesCount(0)
 {
+  cache = new MapTextureCache(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/map-textures");
+
+  layersKey = MapTextureCache::layersKey(map.layers());
 }
 
-int MapTextureGenerator::render(const QgsRectangle &extent, const QString &debugText)
+MapTextureGenerator::~MapTextureGenerator()
 {
-  QgsMapSettings mapSettings(baseMapSettings());
+  threadPool.clear();  // remove tasks that have not started yet
+  threadPool.waitForDone();
+
+  // nobody can wait for requests rendered in the main thread anymore
+  Q_FOREACH (const MapTextureRequestPtr& request, requestJobs)
+    cancelTileRequest(request);
+
+  Q_FOREACH (MapTextureLayerClones* clones, freeClones)
+    _deleteLayerClones(clones);
+
+  delete cache;
+}
+
+int MapTextureGenerator::render(const QgsRectangle &extent, int size, const QString &debugText)
+{
+  QgsMapSettings mapSettings(baseMapSettings(size));
   mapSettings.setExtent(extent);
 
+  JobData jobData;
+  jobData.jobId = ++lastJobId;
+  jobData.extent = extent;
+  jobData.debugText = debugText;
+  currentLayersKey(jobData.layersKey, jobData.cacheGeneration);
+
+  QImage img;
+  if (cache->tile(jobData.layersKey, MapTextureCache::tileKey(mapSettings), img))
+  {
+    // the caller only learns the job ID when we return, so the signal needs to be emitted later
+    _drawDebugText(img, debugText);
+    cachedJobs.insert(jobData.jobId, img);
+    QMetaObject::invokeMethod(this, "onCachedTileReady", Qt::QueuedConnection, Q_ARG(int, jobData.jobId));
+    return jobData.jobId;
+  }
+
   QgsMapRendererSequentialJob* job = new QgsMapRendererSequentialJob(mapSettings);
   connect(job, &QgsMapRendererJob::finished, this, &MapTextureGenerator::onRenderingFinished);
   job->start();
 
-  JobData jobData;
-  jobData.jobId = ++lastJobId;
   jobData.job = job;
-  jobData.extent = extent;
-  jobData.debugText = debugText;
 
   jobs.insert(job, jobData);
   //qDebug() << "added job: " << jobData.jobId << "  .... in queue: " << jobs.count();
@@ -34,6 +160,9 @@ int MapTextureGenerator::render(const QgsRectangle &extent, const QString &debug
 
 void MapTextureGenerator::cancelJob(int jobId)
 {
+  if (cachedJobs.remove(jobId))
+    return;
+
   Q_FOREACH(const JobData& jd, jobs)
   {
     if (jd.jobId == jobId)
@@ -49,27 +178,171 @@ void MapTextureGenerator::cancelJob(int jobId)
   Q_ASSERT(false && "requested job ID does not exist!");
 }
 
-QImage MapTextureGenerator::renderSynchronously(const QgsRectangle &extent, const QString &debugText)
+QImage MapTextureGenerator::renderSynchronously(const QgsRectangle &extent, int size, const QString &debugText)
 {
-  QgsMapSettings mapSettings(baseMapSettings());
+  QgsMapSettings mapSettings(baseMapSettings(size));
   mapSettings.setExtent(extent);
 
-  QgsMapRendererSequentialJob job(mapSettings);
-  job.start();
-  job.waitForFinished();
+  QString key;
+  int generation;
+  currentLayersKey(key, generation);
+  return renderTile(mapSettings, key, generation, debugText);
+}
 
-  QImage img = job.renderedImage();
+MapTextureRequestPtr MapTextureGenerator::requestTile(const QgsRectangle &extent, int size, const QString &debugText)
+{
+  MapTextureRequestPtr request(new MapTextureRequest);
+  request->mapSettings = baseMapSettings(size);
+  request->mapSettings.setExtent(extent);
+  currentLayersKey(request->layersKey, request->cacheGeneration);
+  request->debugText = debugText;
 
-  if (!debugText.isEmpty())
+  if (_hasEditBuffer(map.layers()))
   {
-    // extra tile information for debugging
-    QPainter p(&img);
-    p.setPen(Qt::white);
-    p.drawRect(0,0,img.width()-1, img.height()-1);
-    p.drawText(img.rect(), debugText, QTextOption(Qt::AlignCenter));
-    p.end();
+    // clones do not have the edits - render the original layers here in the main thread
+    // (renderers get prepared here and the job renders them in background)
+    QgsMapRendererSequentialJob* job = new QgsMapRendererSequentialJob(request->mapSettings);
+    connect(job, &QgsMapRendererJob::finished, this, &MapTextureGenerator::onRequestRenderingFinished);
+    request->job = job;
+    request->state = MapTextureRequest::Rendering;
+    requestJobs.insert(job, request);
+    job->start();
+    return request;
   }
 
+  ensureLayerClones();
+  request->state = MapTextureRequest::Queued;
+  threadPool.start(new MapTextureRenderTask(this, request));
+  return request;
+}
+
+QImage MapTextureGenerator::waitForTile(const MapTextureRequestPtr &request)
+{
+  request->mutex.lock();
+  if (request->state == MapTextureRequest::Queued)
+  {
+    // nobody has got to it yet (the pool may be busy with older requests) - render it here
+    request->mutex.unlock();
+    renderRequest(request);
+    request->mutex.lock();
+  }
+  while (request->state != MapTextureRequest::Finished && request->state != MapTextureRequest::Cancelled)
+    request->finished.wait(&request->mutex);
+  QImage img = request->image;
+  request->mutex.unlock();
+  return img;
+}
+
+void MapTextureGenerator::cancelTileRequest(const MapTextureRequestPtr &request)
+{
+  if (QgsMapRendererSequentialJob* job = request->job)
+  {
+    // rendered in the main thread - nobody else would finish the request
+    job->cancelWithoutBlocking();
+    disconnect(job, &QgsMapRendererJob::finished, this, &MapTextureGenerator::onRequestRenderingFinished);
+    job->deleteLater();
+    requestJobs.remove(job);
+    request->job = nullptr;
+  }
+
+  QMutexLocker locker(&request->mutex);
+  if (request->state == MapTextureRequest::Queued || request->state == MapTextureRequest::Rendering)
+  {
+    // requests rendered by other threads finish anyway, the waiting thread just does not need to wait for them
+    request->state = MapTextureRequest::Cancelled;
+    request->finished.wakeAll();
+  }
+}
+
+void MapTextureGenerator::renderRequest(const MapTextureRequestPtr &request)
+{
+  {
+    QMutexLocker locker(&request->mutex);
+    if (request->state != MapTextureRequest::Queued)
+      return;  // already taken by another thread or cancelled
+    request->state = MapTextureRequest::Rendering;
+  }
+
+  // the map settings are only used by the thread that has claimed the request.
+  // Layers and their providers are not safe to use from multiple threads - render copies used only by us
+  MapTextureLayerClones* clones = acquireLayerClones();
+  request->mapSettings.setLayers(clones->layers);
+  QImage img = renderTile(request->mapSettings, request->layersKey, request->cacheGeneration, request->debugText);
+  releaseLayerClones(clones);
+
+  QMutexLocker locker(&request->mutex);
+  if (request->state == MapTextureRequest::Rendering)
+  {
+    request->image = img;
+    request->state = MapTextureRequest::Finished;
+  }
+  request->finished.wakeAll();
+}
+
+void MapTextureGenerator::ensureLayerClones()
+{
+  // one set for each pool thread and one for the thread waiting for a tile
+  int needed = threadPool.maxThreadCount() + 1;
+  if (clonesCount >= needed)
+    return;
+
+  QList<MapTextureLayerClones*> newClones;
+  for (int i = clonesCount; i < needed; ++i)
+  {
+    MapTextureLayerClones* clones = new MapTextureLayerClones;
+    Q_FOREACH (QgsMapLayer* layer, map.layers())
+    {
+      if (QgsMapLayer* clone = layer->clone())
+        clones->layers << clone;
+    }
+    newClones << clones;
+  }
+
+  QMutexLocker locker(&clonesMutex);
+  Q_FOREACH (MapTextureLayerClones* clones, newClones)
+  {
+    clones->version = clonesVersion;
+    freeClones << clones;
+  }
+  clonesCount = needed;
+  clonesAvailable.wakeAll();
+}
+
+MapTextureLayerClones *MapTextureGenerator::acquireLayerClones()
+{
+  QMutexLocker locker(&clonesMutex);
+  while (freeClones.isEmpty())
+    clonesAvailable.wait(&clonesMutex);
+  return freeClones.takeLast();
+}
+
+void MapTextureGenerator::releaseLayerClones(MapTextureLayerClones *clones)
+{
+  QMutexLocker locker(&clonesMutex);
+  if (clones->version != clonesVersion)
+  {
+    _deleteLayerClones(clones);  // layers or styles have changed in the meanwhile
+    return;
+  }
+  freeClones << clones;
+  clonesAvailable.wakeOne();
+}
+
+QImage MapTextureGenerator::renderTile(const QgsMapSettings &mapSettings, const QString &key, int generation, const QString &debugText)
+{
+  QImage img;
+  if (!cache->tile(key, MapTextureCache::tileKey(mapSettings), img))
+  {
+    QgsMapRendererSequentialJob job(mapSettings);
+    job.start();
+    job.waitForFinished();
+
+    img = job.renderedImage();
+    addToCache(key, generation, mapSettings, img);
+  }
+
+  _drawDebugText(img, debugText);
+
   return img;
 }
 
@@ -82,16 +355,9 @@ void MapTextureGenerator::onRenderingFinished()
   JobData jobData = jobs.value(mapJob);
 
   QImage img = mapJob->renderedImage();
+  addToCache(jobData.layersKey, jobData.cacheGeneration, mapJob->mapSettings(), img);
 
-  if (!jobData.debugText.isEmpty())
-  {
-    // extra tile information for debugging
-    QPainter p(&img);
-    p.setPen(Qt::white);
-    p.drawRect(0,0,img.width()-1, img.height()-1);
-    p.drawText(img.rect(), jobData.debugText, QTextOption(Qt::AlignCenter));
-    p.end();
-  }
+  _drawDebugText(img, jobData.debugText);
 
   mapJob->deleteLater();
   jobs.remove(mapJob);
@@ -102,12 +368,93 @@ void MapTextureGenerator::onRenderingFinished()
   emit tileReady(jobData.jobId, img);
 }
 
-QgsMapSettings MapTextureGenerator::baseMapSettings()
+void MapTextureGenerator::onRequestRenderingFinished()
+{
+  QgsMapRendererSequentialJob* job = static_cast<QgsMapRendererSequentialJob*>(sender());
+  Q_ASSERT(requestJobs.contains(job));
+  MapTextureRequestPtr request = requestJobs.take(job);
+  request->job = nullptr;
+  job->deleteLater();
+
+  QImage img = job->renderedImage();
+  addToCache(request->layersKey, request->cacheGeneration, job->mapSettings(), img);
+  _drawDebugText(img, request->debugText);
+
+  QMutexLocker locker(&request->mutex);
+  request->image = img;
+  request->state = MapTextureRequest::Finished;
+  request->finished.wakeAll();
+}
+
+void MapTextureGenerator::onCachedTileReady(int jobId)
+{
+  if (!cachedJobs.contains(jobId))
+    return;  // cancelled in the meanwhile
+
+  emit tileReady(jobId, cachedJobs.take(jobId));
+}
+
+bool MapTextureGenerator::invalidateTiles(const QgsRectangle &extent)
+{
+  // the key may also change (e.g. if the style got updated)
+  QString newKey = MapTextureCache::layersKey(map.layers());
+  bool keyChanged = newKey != layersKey;
+  bool all = extent.isNull() || keyChanged;
+
+  {
+    QWriteLocker locker(&layersKeyLock);
+    cache->removeTiles(layersKey, all ? QgsRectangle() : extent);
+    layersKey = newKey;
+    ++cacheGeneration;
+  }
+
+  // data changes without a change of layers or styles are picked up by the clones' own providers
+  if (keyChanged)
+    updateLayerClones();
+  return all;
+}
+
+void MapTextureGenerator::updateLayerClones()
+{
+  bool used;
+  {
+    // clones in use get deleted when they are released
+    QMutexLocker locker(&clonesMutex);
+    used = clonesCount > 0;
+    ++clonesVersion;
+    clonesCount = 0;
+    Q_FOREACH (MapTextureLayerClones* clones, freeClones)
+      _deleteLayerClones(clones);
+    freeClones.clear();
+  }
+
+  // requests may be already queued - they need the new clones
+  if (used)
+    ensureLayerClones();
+}
+
+QgsMapSettings MapTextureGenerator::baseMapSettings(int size)
 {
   QgsMapSettings mapSettings;
   mapSettings.setLayers(map.layers());
-  mapSettings.setOutputSize(QSize(map.tileTextureSize,map.tileTextureSize));
+  mapSettings.setOutputSize(QSize(size, size));
   mapSettings.setDestinationCrs(map.crs);
   mapSettings.setBackgroundColor(Qt::gray);
   return mapSettings;
 }
+
+void MapTextureGenerator::currentLayersKey(QString &key, int &generation)
+{
+  QReadLocker locker(&layersKeyLock);
+  key = layersKey;
+  generation = cacheGeneration;
+}
+
+void MapTextureGenerator::addToCache(const QString &key, int generation, const QgsMapSettings &mapSettings, const QImage &img)
+{
+  // tiles that started rendering before invalidation may contain outdated content.
+  // Read lock only, so that multiple threads can write their tiles at once
+  QReadLocker locker(&layersKeyLock);
+  if (generation == cacheGeneration)
+    cache->addTile(key, MapTextureCache::tileKey(mapSettings), mapSettings.extent(), img);
+}
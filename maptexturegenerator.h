@@ -1,59 +1,125 @@
 #ifndef MAPTEXTUREGENERATOR_H
 #define MAPTEXTUREGENERATOR_H
 
+class QgsMapLayer;
 class QgsMapRendererSequentialJob;
 class QgsMapSettings;
 class QgsProject;
 class QgsRasterLayer;
 
+#include <QMutex>
 #include <QObject>
+#include <QReadWriteLock>
+#include <QSharedPointer>
+#include <QThreadPool>
+#include <QWaitCondition>
 
 #include "qgsrectangle.h"
 
 class Map3D;
+class MapTextureCache;
+
+struct MapTextureLayerClones;
+struct MapTextureRequest;
+typedef QSharedPointer<MapTextureRequest> MapTextureRequestPtr;
 
 /**
  * Responsible for:
  * - rendering map tiles in background
- * - caching tiles on disk (?)
+ * - rendering multiple map tiles in parallel in a thread pool
+ * - caching rendered tiles in memory and on disk
  */
 class MapTextureGenerator : public QObject
 {
   Q_OBJECT
 public:
   MapTextureGenerator(const Map3D& map);
+  ~MapTextureGenerator();
 
-  //! Start async rendering of a map for the given extent (must be a square!)
+  //! Start async rendering of a map for the given extent (must be a square!) to an image of given size.
   //! Returns job ID
-  int render(const QgsRectangle& extent, const QString& debugText = QString());
+  int render(const QgsRectangle& extent, int size, const QString& debugText = QString());
 
   //! Cancels a rendering job
   void cancelJob(int jobId);
 
-  //! Render a map and return rendered image
-  QImage renderSynchronously(const QgsRectangle& extent, const QString& debugText = QString());
+  //! Render a map and return rendered image (or return the image from the cache if it has been rendered already).
+  //! Can be called from a worker thread
+  QImage renderSynchronously(const QgsRectangle& extent, int size, const QString& debugText = QString());
+
+  //! Queues rendering of a map in the thread pool. Map settings are taken at the time of the request,
+  //! so this must be called from the main thread. Pool threads render their own copies of layers
+  //! (kept until layers or styles change). Layers with uncommitted edits are rendered from the originals
+  //! by a job started in the main thread instead. Use waitForTile() to get the image
+  MapTextureRequestPtr requestTile(const QgsRectangle& extent, int size, const QString& debugText = QString());
+
+  //! Returns image of a requested tile, blocking until it is rendered. If no pool thread
+  //! has started rendering the tile yet, it gets rendered in the calling thread.
+  //! Returns null image if the request has been cancelled
+  QImage waitForTile(const MapTextureRequestPtr& request);
+
+  //! Drops a requested tile (threads waiting for it get null image). Must be called from the main thread
+  void cancelTileRequest(const MapTextureRequestPtr& request);
+
+  //! Drops cached tiles that intersect the extent (in map CRS) because layers' data have changed there.
+  //! With null extent all cached tiles are dropped. Returns true if all tiles have been dropped
+  //! (also happens when layers' styles have changed)
+  bool invalidateTiles(const QgsRectangle& extent = QgsRectangle());
 
 signals:
   void tileReady(int jobId, const QImage& image);
 
 private slots:
   void onRenderingFinished();
+  void onCachedTileReady(int jobId);
+  void onRequestRenderingFinished();
 
 private:
-  QgsMapSettings baseMapSettings();
+  QgsMapSettings baseMapSettings(int size);
+  void currentLayersKey(QString& key, int& generation);
+  QImage renderTile(const QgsMapSettings& mapSettings, const QString& key, int generation, const QString& debugText);
+  void renderRequest(const MapTextureRequestPtr& request);
+  void addToCache(const QString& key, int generation, const QgsMapSettings& mapSettings, const QImage& img);
+
+  //! creates missing sets of layer clones for pool threads (in the main thread, where the layers live)
+  void ensureLayerClones();
+  //! drops the current sets of layer clones (layers or styles have changed)
+  void updateLayerClones();
+  //! blocks until a set of layer clones is available for the calling thread
+  MapTextureLayerClones* acquireLayerClones();
+  void releaseLayerClones(MapTextureLayerClones* clones);
 
   const Map3D& map;
 
+  MapTextureCache* cache;
+  QReadWriteLock layersKeyLock;
+  QString layersKey;   //!< identifies current layers and their styles in the cache (protected by layersKeyLock)
+  int cacheGeneration;  //!< increased whenever cached tiles get invalidated (protected by layersKeyLock)
+
   struct JobData
   {
     int jobId;
     QgsMapRendererSequentialJob* job;
     QgsRectangle extent;
     QString debugText;
+    QString layersKey;
+    int cacheGeneration;
   };
 
   QHash<QgsMapRendererSequentialJob*, JobData> jobs;
+  QHash<int, QImage> cachedJobs;   //!< jobs that were satisfied from the cache and wait for tileReady() to be emitted
   int lastJobId;
+
+  QThreadPool threadPool;   //!< for tiles from requestTile()
+  QHash<QgsMapRendererSequentialJob*, MapTextureRequestPtr> requestJobs;  //!< requested tiles rendered in the main thread
+
+  QMutex clonesMutex;
+  QWaitCondition clonesAvailable;
+  QList<MapTextureLayerClones*> freeClones;   //!< sets of clones not used by any thread (protected by clonesMutex)
+  int clonesVersion;   //!< increased when layers or styles change (protected by clonesMutex)
+  int clonesCount;     //!< number of sets of the current version (protected by clonesMutex)
+
+  friend class MapTextureRenderTask;
 };
 
 
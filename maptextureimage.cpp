@@ -10,6 +10,7 @@ public:
     QgsRectangle extent;
     QString debugText;
     QImage img;
+    Qt3DRender::QTextureImageDataPtr data;
 
     static QImage placeholderImage()
     {
@@ -22,11 +23,14 @@ public:
       return i;
     }
 
-    MapTextureImageDataGenerator(const QgsRectangle& extent, const QString& debugText, const QImage& img)
-      : extent(extent), debugText(debugText), img(img) {}
+    MapTextureImageDataGenerator(const QgsRectangle& extent, const QString& debugText, const QImage& img, const Qt3DRender::QTextureImageDataPtr& data)
+      : extent(extent), debugText(debugText), img(img), data(data) {}
 
     virtual Qt3DRender::QTextureImageDataPtr operator()() override
     {
+      if (data)
+        return data;  // already prepared in a worker thread
+
       Qt3DRender::QTextureImageDataPtr dataPtr = Qt3DRender::QTextureImageDataPtr::create();
       dataPtr->setImage(img.isNull() ? placeholderImage() : img); // will copy image data to the internal byte array
       return dataPtr;
@@ -36,14 +40,14 @@ public:
     {
       const MapTextureImageDataGenerator *otherFunctor = functor_cast<MapTextureImageDataGenerator>(&other);
       return otherFunctor != nullptr && otherFunctor->img.isNull() == img.isNull() &&
-          extent == otherFunctor->extent;
+          otherFunctor->data == data && extent == otherFunctor->extent;
     }
 
     QT3D_FUNCTOR(MapTextureImageDataGenerator)
 };
 
 
-MapTextureImage::MapTextureImage(MapTextureGenerator *mapGen, const QgsRectangle& extent, const QString& debugText, Qt3DCore::QNode *parent)
+MapTextureImage::MapTextureImage(MapTextureGenerator *mapGen, const QgsRectangle& extent, int size, const QString& debugText, Qt3DCore::QNode *parent)
   : Qt3DRender::QAbstractTextureImage(parent)
   , mapGen(mapGen)
   , extent(extent)
@@ -53,7 +57,7 @@ MapTextureImage::MapTextureImage(MapTextureGenerator *mapGen, const QgsRectangle
   connect(mapGen, &MapTextureGenerator::tileReady, this, &MapTextureImage::onTileReady);
 
   // request image
-  jobId = mapGen->render(extent, debugText);
+  jobId = mapGen->render(extent, size, debugText);
 }
 
 
@@ -67,6 +71,16 @@ MapTextureImage::MapTextureImage(const QImage& image, const QgsRectangle& extent
 }
 
 
+MapTextureImage::MapTextureImage(const Qt3DRender::QTextureImageDataPtr& data, const QgsRectangle& extent, const QString& debugText, Qt3DCore::QNode *parent)
+  : Qt3DRender::QAbstractTextureImage(parent)
+  , extent(extent)
+  , debugText(debugText)
+  , dataGen(new MapTextureImageDataGenerator(extent, debugText, QImage(), data))
+  , jobDone(true)
+{
+}
+
+
 MapTextureImage::~MapTextureImage()
 {
   if (!jobDone)
@@ -75,7 +89,9 @@ MapTextureImage::~MapTextureImage()
 
 Qt3DRender::QTextureImageDataGeneratorPtr MapTextureImage::dataGenerator() const
 {
-  return Qt3DRender::QTextureImageDataGeneratorPtr(new MapTextureImageDataGenerator(extent, debugText, img));
+  if (dataGen)
+    return dataGen;  // the only holder of the prepared data
+  return Qt3DRender::QTextureImageDataGeneratorPtr(new MapTextureImageDataGenerator(extent, debugText, img, Qt3DRender::QTextureImageDataPtr()));
 }
 
 void MapTextureImage::onTileReady(int jobId, const QImage &img)
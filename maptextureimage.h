@@ -2,6 +2,7 @@
 #define MAPTEXTUREIMAGE_H
 
 #include <Qt3DRender/QAbstractTextureImage>
+#include <Qt3DRender/QTextureImageData>
 
 #include "qgsrectangle.h"
 
@@ -12,14 +13,25 @@ class MapTextureImage : public Qt3DRender::QAbstractTextureImage
 {
   Q_OBJECT
 public:
-  //! constructor that will generate image asynchronously
-  MapTextureImage(MapTextureGenerator* mapGen, const QgsRectangle& extent, const QString& debugText = QString(), Qt3DCore::QNode *parent = nullptr);
+  //! constructor that will generate image of given size asynchronously
+  MapTextureImage(MapTextureGenerator* mapGen, const QgsRectangle& extent, int size, const QString& debugText = QString(), Qt3DCore::QNode *parent = nullptr);
   //! constructor that uses already prepared image
   MapTextureImage(const QImage& image, const QgsRectangle& extent, const QString& debugText, Qt3DCore::QNode *parent = nullptr);
+  //! constructor that uses texture data already prepared in a worker thread. The data are referenced only
+  //! by the data generator, which Qt3D keeps (and may call again, e.g. when the texture gets recreated)
+  //! for as long as the image exists
+  MapTextureImage(const Qt3DRender::QTextureImageDataPtr& data, const QgsRectangle& extent, const QString& debugText, Qt3DCore::QNode *parent = nullptr);
   ~MapTextureImage();
 
   virtual Qt3DRender::QTextureImageDataGeneratorPtr dataGenerator() const override;
 
+  //! Returns map extent of the image
+  QgsRectangle imageExtent() const { return extent; }
+  //! Returns extra text drawn to the image (for debugging)
+  QString imageDebugText() const { return debugText; }
+  //! Returns rendered image (null until it is ready or if the image was created from texture data)
+  QImage image() const { return img; }
+
 private slots:
   void onTileReady(int jobId, const QImage& img);
 
@@ -31,6 +43,7 @@ private:
   QgsRectangle extent;
   QString debugText;
   QImage img;
+  Qt3DRender::QTextureImageDataGeneratorPtr dataGen;  //!< not null if created from prepared texture data
   int jobId;
   bool jobDone;
 };
@@ -0,0 +1,74 @@
+#include "mipmapgenerator.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+//! average of four pixels, each channel separately (with rounding)
+static inline quint32 _average4(quint32 a, quint32 b, quint32 c, quint32 d)
+{
+  quint32 res = 0;
+  for (int shift = 0; shift < 32; shift += 8)
+  {
+    quint32 sum = ((a >> shift) & 0xff) + ((b >> shift) & 0xff) + ((c >> shift) & 0xff) + ((d >> shift) & 0xff);
+    res |= ((sum + 2) >> 2) << shift;
+  }
+  return res;
+}
+
+
+QImage downsampleImage(const QImage& image)
+{
+  Q_ASSERT(image.depth() == 32);
+
+  int srcWidth = image.width(), srcHeight = image.height();
+  int width = qMax(1, srcWidth / 2), height = qMax(1, srcHeight / 2);
+  QImage res(width, height, image.format());
+
+  for (int y = 0; y < height; ++y)
+  {
+    // the last row/column gets repeated when the source is only one pixel thick
+    const quint32* line0 = reinterpret_cast<const quint32*>(image.constScanLine(2 * y));
+    const quint32* line1 = reinterpret_cast<const quint32*>(image.constScanLine(qMin(2 * y + 1, srcHeight - 1)));
+    quint32* out = reinterpret_cast<quint32*>(res.scanLine(y));
+
+    int x = 0;
+#ifdef __SSE2__
+    // four output pixels from 2x8 source pixels at once: first average the rows, then pairs of pixels
+    // (rounding is done twice, so the result may be off by one compared to the scalar code)
+    for (; x + 4 <= width && 2 * x + 8 <= srcWidth; x += 4)
+    {
+      __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(line0 + 2 * x));
+      __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(line0 + 2 * x + 4));
+      __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(line1 + 2 * x));
+      __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(line1 + 2 * x + 4));
+      __m128 v0 = _mm_castsi128_ps(_mm_avg_epu8(a0, b0));
+      __m128 v1 = _mm_castsi128_ps(_mm_avg_epu8(a1, b1));
+      __m128i even = _mm_castps_si128(_mm_shuffle_ps(v0, v1, _MM_SHUFFLE(2, 0, 2, 0)));
+      __m128i odd = _mm_castps_si128(_mm_shuffle_ps(v0, v1, _MM_SHUFFLE(3, 1, 3, 1)));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm_avg_epu8(even, odd));
+    }
+#endif
+    for (; x < width; ++x)
+    {
+      int x0 = 2 * x, x1 = qMin(2 * x + 1, srcWidth - 1);
+      out[x] = _average4(line0[x0], line0[x1], line1[x0], line1[x1]);
+    }
+  }
+  return res;
+}
+
+
+QVector<QImage> generateMipmaps(const QImage& image)
+{
+  QVector<QImage> levels;
+  if (image.depth() == 32)
+    levels << image;
+  else
+    levels << image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+
+  while (levels.last().width() > 1 || levels.last().height() > 1)
+    levels << downsampleImage(levels.last());
+  return levels;
+}
@@ -0,0 +1,15 @@
+#ifndef MIPMAPGENERATOR_H
+#define MIPMAPGENERATOR_H
+
+#include <QImage>
+#include <QVector>
+
+//! Returns image with half width and height (at least 1 pixel) where each pixel is
+//! an average of 2x2 block of the source image. The image needs to have 32 bits per pixel
+QImage downsampleImage(const QImage& image);
+
+//! Returns complete mip chain of an image: the first item is the image itself (converted to 32-bit format
+//! if necessary), the last one has size 1x1. The size of each level is half of the previous one (rounded down)
+QVector<QImage> generateMipmaps(const QImage& image);
+
+#endif // MIPMAPGENERATOR_H
@@ -20,8 +20,10 @@
 #endif
 
 #include <QUrl>
+#include <QVector2D>
 #include <QVector3D>
 
+#include "chunkedentity.h"
 #include "map3d.h"
 #include "terraingenerator.h"
 
@@ -29,77 +31,34 @@
 #include "qgspoint.h"
 
 
+//! instances get sorted again to full geometry / billboards only when the camera moves
+//! by more than this fraction of the billboard distance
+static const float LOD_UPDATE_FRACTION = 0.1f;
 
-PointEntity::PointEntity(const Map3D& map, const PointRenderer& settings, Qt3DCore::QNode* parent)
-  : Qt3DCore::QEntity(parent)
+//! billboard shader draws the shape as a shaded disc (sphere) or as an upright shaded column (anything else)
+enum BillboardType
 {
-  //
-  // load features
-  //
+  BillboardSphere = 0,
+  BillboardColumn = 1,
+};
 
-  QList<QVector3D> positions;
-  QgsFeature f;
-  QgsFeatureRequest request;
-  request.setDestinationCrs(map.crs, QgsCoordinateTransformContext());
-  QgsFeatureIterator fi = settings.layer()->getFeatures(request);
-  while (fi.nextFeature(f))
-  {
-    if (f.geometry().isNull())
-      continue;
-
-    const QgsAbstractGeometry* g = f.geometry().constGet();
-    if (QgsWkbTypes::flatType(g->wkbType()) == QgsWkbTypes::Point)
-    {
-      const QgsPoint* pt = static_cast<const QgsPoint*>(g);
-      // TODO: use Z coordinates if the point is 3D
-      float h = map.terrainGenerator->heightAt(pt->x(), pt->y(), map) * map.zExaggeration;
-      positions.append(QVector3D(pt->x() - map.originX, h + settings.height, -(pt->y() - map.originY)));
-      //qDebug() << positions.last();
-    }
-    else
-      qDebug() << "not a point";
-  }
-
-  int count = positions.count();
-
-  QByteArray ba;
-  ba.resize(count * sizeof(QVector3D));
-  QVector3D *posData = reinterpret_cast<QVector3D *>(ba.data());
-  for (int j = 0; j < count; ++j)
-  {
-    *posData = positions[j];
-    ++posData;
-  }
-
-  //
-  // geometry renderer
-  //
-
-  Qt3DRender::QBuffer* instanceBuffer = new Qt3DRender::QBuffer(Qt3DRender::QBuffer::VertexBuffer);
-  instanceBuffer->setData(ba);
-
-  Qt3DRender::QAttribute* instanceDataAttribute = new Qt3DRender::QAttribute;
-  instanceDataAttribute->setName("pos");
-  instanceDataAttribute->setAttributeType(Qt3DRender::QAttribute::VertexAttribute);
-  instanceDataAttribute->setVertexBaseType(Qt3DRender::QAttribute::Float);
-  instanceDataAttribute->setVertexSize(3);
-  instanceDataAttribute->setDivisor(1);
-  instanceDataAttribute->setBuffer(instanceBuffer);
 
+static Qt3DRender::QGeometry* _shapeGeometry(const QVariantMap& shapeProperties)
+{
   Qt3DRender::QGeometry* geometry = nullptr;
-  QString shape = settings.shapeProperties["shape"].toString();
+  QString shape = shapeProperties["shape"].toString();
   if (shape == "sphere")
   {
-    float radius = settings.shapeProperties["radius"].toFloat();
+    float radius = shapeProperties["radius"].toFloat();
     Qt3DExtras::QSphereGeometry* g = new Qt3DExtras::QSphereGeometry;
     g->setRadius(radius ? radius : 10);
     geometry = g;
   }
   else if (shape == "cone")
   {
-    float length = settings.shapeProperties["length"].toFloat();
-    float bottomRadius = settings.shapeProperties["bottomRadius"].toFloat();
-    float topRadius = settings.shapeProperties["topRadius"].toFloat();
+    float length = shapeProperties["length"].toFloat();
+    float bottomRadius = shapeProperties["bottomRadius"].toFloat();
+    float topRadius = shapeProperties["topRadius"].toFloat();
     Qt3DExtras::QConeGeometry* g = new Qt3DExtras::QConeGeometry;
     g->setLength(length ? length : 10);
     g->setBottomRadius(bottomRadius);
@@ -110,7 +69,7 @@ PointEntity::PointEntity(const Map3D& map, const PointRenderer& settings, Qt3DCo
   }
   else if (shape == "cube")
   {
-    float size = settings.shapeProperties["size"].toFloat();
+    float size = shapeProperties["size"].toFloat();
     Qt3DExtras::QCuboidGeometry* g = new Qt3DExtras::QCuboidGeometry;
     g->setXExtent(size ? size : 10);
     g->setYExtent(size ? size : 10);
@@ -119,8 +78,8 @@ PointEntity::PointEntity(const Map3D& map, const PointRenderer& settings, Qt3DCo
   }
   else if (shape == "torus")
   {
-    float radius = settings.shapeProperties["radius"].toFloat();
-    float minorRadius = settings.shapeProperties["minorRadius"].toFloat();
+    float radius = shapeProperties["radius"].toFloat();
+    float minorRadius = shapeProperties["minorRadius"].toFloat();
     Qt3DExtras::QTorusGeometry* g = new Qt3DExtras::QTorusGeometry;
     g->setRadius(radius ? radius : 10);
     g->setMinorRadius(minorRadius ? minorRadius : 5);
@@ -128,7 +87,7 @@ PointEntity::PointEntity(const Map3D& map, const PointRenderer& settings, Qt3DCo
   }
   else if (shape == "plane")
   {
-    float size = settings.shapeProperties["size"].toFloat();
+    float size = shapeProperties["size"].toFloat();
     Qt3DExtras::QPlaneGeometry* g = new Qt3DExtras::QPlaneGeometry;
     g->setWidth(size ? size : 10);
     g->setHeight(size ? size : 10);
@@ -137,8 +96,8 @@ PointEntity::PointEntity(const Map3D& map, const PointRenderer& settings, Qt3DCo
 #if QT_VERSION >= 0x050900
   else if (shape == "extrudedText")
   {
-    float depth = settings.shapeProperties["depth"].toFloat();
-    QString text = settings.shapeProperties["text"].toString();
+    float depth = shapeProperties["depth"].toFloat();
+    QString text = shapeProperties["text"].toString();
     Qt3DExtras::QExtrudedTextGeometry* g = new Qt3DExtras::QExtrudedTextGeometry;
     g->setDepth(depth ? depth : 1);
     g->setText(text);
@@ -147,8 +106,8 @@ PointEntity::PointEntity(const Map3D& map, const PointRenderer& settings, Qt3DCo
 #endif
   else  // shape == "cylinder" or anything else
   {
-    float radius = settings.shapeProperties["radius"].toFloat();
-    float length = settings.shapeProperties["length"].toFloat();
+    float radius = shapeProperties["radius"].toFloat();
+    float length = shapeProperties["length"].toFloat();
     Qt3DExtras::QCylinderGeometry* g = new Qt3DExtras::QCylinderGeometry;
     //g->setRings(2);  // how many vertices vertically
     //g->setSlices(8); // how many vertices on circumference
@@ -156,18 +115,117 @@ PointEntity::PointEntity(const Map3D& map, const PointRenderer& settings, Qt3DCo
     g->setLength(length ? length: 10);
     geometry = g;
   }
+  return geometry;
+}
 
-  geometry->addAttribute(instanceDataAttribute);
+//! Finds how to draw the shape as a billboard: its center (relative to the point) and half of its size
+//! after the instance transform. Returns false if the shape has no sensible billboard (e.g. text)
+static bool _billboardShape(const Qt3DRender::QGeometry* geometry, const QMatrix4x4& transform, QVector3D& center, QVector2D& halfSize, BillboardType& type)
+{
+  // bounding box of the shape in its own coordinates (all shapes are centered at the origin)
+  QVector3D ext;
+  type = BillboardColumn;
+  if (const Qt3DExtras::QSphereGeometry* g = qobject_cast<const Qt3DExtras::QSphereGeometry*>(geometry))
+  {
+    ext = QVector3D(g->radius(), g->radius(), g->radius());
+    type = BillboardSphere;
+  }
+  else if (const Qt3DExtras::QConeGeometry* g = qobject_cast<const Qt3DExtras::QConeGeometry*>(geometry))
+  {
+    float r = qMax(g->bottomRadius(), g->topRadius());
+    ext = QVector3D(r, g->length() / 2, r);
+  }
+  else if (const Qt3DExtras::QCuboidGeometry* g = qobject_cast<const Qt3DExtras::QCuboidGeometry*>(geometry))
+    ext = QVector3D(g->xExtent(), g->yExtent(), g->zExtent()) / 2;
+  else if (const Qt3DExtras::QTorusGeometry* g = qobject_cast<const Qt3DExtras::QTorusGeometry*>(geometry))
+    ext = QVector3D(g->radius() + g->minorRadius(), g->radius() + g->minorRadius(), g->minorRadius());
+  else if (const Qt3DExtras::QPlaneGeometry* g = qobject_cast<const Qt3DExtras::QPlaneGeometry*>(geometry))
+    ext = QVector3D(g->width() / 2, 0, g->height() / 2);
+  else if (const Qt3DExtras::QCylinderGeometry* g = qobject_cast<const Qt3DExtras::QCylinderGeometry*>(geometry))
+    ext = QVector3D(g->radius(), g->length() / 2, g->radius());
+  else
+    return false;
+
+  // bounding box of the transformed corners
+  QVector3D vMin, vMax;
+  for (int i = 0; i < 8; ++i)
+  {
+    QVector3D corner(i & 1 ? ext.x() : -ext.x(), i & 2 ? ext.y() : -ext.y(), i & 4 ? ext.z() : -ext.z());
+    QVector3D v = transform * corner;
+    vMin = i == 0 ? v : QVector3D(qMin(vMin.x(), v.x()), qMin(vMin.y(), v.y()), qMin(vMin.z(), v.z()));
+    vMax = i == 0 ? v : QVector3D(qMax(vMax.x(), v.x()), qMax(vMax.y(), v.y()), qMax(vMax.z(), v.z()));
+  }
+
+  center = (vMin + vMax) / 2;
+  QVector3D size = (vMax - vMin) / 2;
+  float horizontal = qMax(size.x(), size.z());
+  if (type == BillboardSphere)
+    halfSize = QVector2D(1, 1) * qMax(horizontal, size.y());
+  else
+    halfSize = QVector2D(horizontal, size.y());
+  return true;
+}
+
+//! Quad with corners at [-1,-1] .. [1,1] - the billboard shader scales and turns it towards the camera
+static Qt3DRender::QGeometry* _billboardGeometry()
+{
+  QByteArray ba;
+  ba.resize(4 * 3 * sizeof(float));
+  float* v = reinterpret_cast<float*>(ba.data());
+  const float corners[] = { -1, -1,  1, -1,  -1, 1,  1, 1 };
+  for (int i = 0; i < 4; ++i)
+  {
+    *v++ = corners[i*2];
+    *v++ = corners[i*2+1];
+    *v++ = 0;
+  }
+
+  Qt3DRender::QGeometry* geometry = new Qt3DRender::QGeometry;
+  Qt3DRender::QBuffer* vertexBuffer = new Qt3DRender::QBuffer(Qt3DRender::QBuffer::VertexBuffer, geometry);
+  vertexBuffer->setData(ba);
+
+  Qt3DRender::QAttribute* positionAttribute = new Qt3DRender::QAttribute;
+  positionAttribute->setName(Qt3DRender::QAttribute::defaultPositionAttributeName());
+  positionAttribute->setAttributeType(Qt3DRender::QAttribute::VertexAttribute);
+  positionAttribute->setVertexBaseType(Qt3DRender::QAttribute::Float);
+  positionAttribute->setVertexSize(3);
+  positionAttribute->setByteStride(3 * sizeof(float));
+  positionAttribute->setCount(4);
+  positionAttribute->setBuffer(vertexBuffer);
+  geometry->addAttribute(positionAttribute);
+  return geometry;
+}
+
+//! Attribute with position of each instance taken from the given buffer
+static Qt3DRender::QAttribute* _instanceAttribute(Qt3DRender::QBuffer* instanceBuffer)
+{
+  Qt3DRender::QAttribute* instanceDataAttribute = new Qt3DRender::QAttribute;
+  instanceDataAttribute->setName("pos");
+  instanceDataAttribute->setAttributeType(Qt3DRender::QAttribute::VertexAttribute);
+  instanceDataAttribute->setVertexBaseType(Qt3DRender::QAttribute::Float);
+  instanceDataAttribute->setVertexSize(3);
+  instanceDataAttribute->setDivisor(1);
+  instanceDataAttribute->setBuffer(instanceBuffer);
+  return instanceDataAttribute;
+}
+
+//! Instanced geometry renderer of a shared shape. Attributes of the shape (and their buffers)
+//! are not copied - the new geometry just references them together with the instance attribute
+static Qt3DRender::QGeometryRenderer* _instancedRenderer(const Qt3DRender::QGeometry* shape, Qt3DRender::QAttribute* instanceAttribute)
+{
+  Qt3DRender::QGeometry* geometry = new Qt3DRender::QGeometry;
+  Q_FOREACH (Qt3DRender::QAttribute* attribute, shape->attributes())
+    geometry->addAttribute(attribute);
+  geometry->addAttribute(instanceAttribute);
 
   Qt3DRender::QGeometryRenderer* renderer = new Qt3DRender::QGeometryRenderer;
   renderer->setGeometry(geometry);
-  renderer->setInstanceCount(count);
-  addComponent(renderer);
-
-  //
-  // material
-  //
+  return renderer;
+}
 
+//! Material using the given instancing shaders (from resources) with the phong parameters
+static Qt3DRender::QMaterial* _material(const PhongMaterialSettings& settings, const QString& shaderName)
+{
   Qt3DRender::QFilterKey* filterKey = new Qt3DRender::QFilterKey;
   filterKey->setName("renderingStyle");
   filterKey->setValue("forward");
@@ -176,8 +234,8 @@ PointEntity::PointEntity(const Map3D& map, const PointRenderer& settings, Qt3DCo
   // (instead of whatever light we have defined in the scene)
   // TODO: use phong shading that respects lights from the scene
   Qt3DRender::QShaderProgram* shaderProgram = new Qt3DRender::QShaderProgram;
-  shaderProgram->setVertexShaderCode(Qt3DRender::QShaderProgram::loadSource(QUrl("qrc:/shaders/instanced.vert")));
-  shaderProgram->setFragmentShaderCode(Qt3DRender::QShaderProgram::loadSource(QUrl("qrc:/shaders/instanced.frag")));
+  shaderProgram->setVertexShaderCode(Qt3DRender::QShaderProgram::loadSource(QUrl(QString("qrc:/shaders/%1.vert").arg(shaderName))));
+  shaderProgram->setFragmentShaderCode(Qt3DRender::QShaderProgram::loadSource(QUrl(QString("qrc:/shaders/%1.frag").arg(shaderName))));
 
   Qt3DRender::QRenderPass* renderPass = new Qt3DRender::QRenderPass;
   renderPass->setShaderProgram(shaderProgram);
@@ -195,12 +253,29 @@ PointEntity::PointEntity(const Map3D& map, const PointRenderer& settings, Qt3DCo
   Qt3DRender::QParameter* specularParameter = new Qt3DRender::QParameter(QStringLiteral("ks"), QColor::fromRgbF(0.01f, 0.01f, 0.01f, 1.0f));
   Qt3DRender::QParameter* shininessParameter = new Qt3DRender::QParameter(QStringLiteral("shininess"), 150.0f);
 
-  diffuseParameter->setValue(settings.material.diffuse());
-  ambientParameter->setValue(settings.material.ambient());
-  specularParameter->setValue(settings.material.specular());
-  shininessParameter->setValue(settings.material.shininess());
+  diffuseParameter->setValue(settings.diffuse());
+  ambientParameter->setValue(settings.ambient());
+  specularParameter->setValue(settings.specular());
+  shininessParameter->setValue(settings.shininess());
+
+  Qt3DRender::QEffect* effect = new Qt3DRender::QEffect;
+  effect->addTechnique(technique);
+
+  effect->addParameter(ambientParameter);
+  effect->addParameter(diffuseParameter);
+  effect->addParameter(specularParameter);
+  effect->addParameter(shininessParameter);
+
+  Qt3DRender::QMaterial* material = new Qt3DRender::QMaterial;
+  material->setEffect(effect);
+  return material;
+}
 
-  QMatrix4x4 transformMatrix = settings.transform;
+
+//! Material of a part drawn with the full shape geometry
+static Qt3DRender::QMaterial* _partMaterial(const PointSymbolPart& part)
+{
+  QMatrix4x4 transformMatrix = part.transform;
   QMatrix3x3 normalMatrix = transformMatrix.normalMatrix();  // transponed inverse of 3x3 sub-matrix
 
   // QMatrix3x3 is not supported for passing to shaders, so we pass QMatrix4x4
@@ -219,17 +294,189 @@ PointEntity::PointEntity(const Map3D& map, const PointRenderer& settings, Qt3DCo
   paramInstNormal->setName("instNormal");
   paramInstNormal->setValue(normalMatrix4);
 
-  Qt3DRender::QEffect* effect = new Qt3DRender::QEffect;
-  effect->addTechnique(technique);
-  effect->addParameter(paramInst);
-  effect->addParameter(paramInstNormal);
+  Qt3DRender::QMaterial* material = _material(part.material, "instanced");
+  material->effect()->addParameter(paramInst);
+  material->effect()->addParameter(paramInstNormal);
+  return material;
+}
 
-  effect->addParameter(ambientParameter);
-  effect->addParameter(diffuseParameter);
-  effect->addParameter(specularParameter);
-  effect->addParameter(shininessParameter);
+// ---------------
 
-  Qt3DRender::QMaterial* material = new Qt3DRender::QMaterial;
-  material->setEffect(effect);
-  addComponent(material);
+PointShapeGeometries::PointShapeGeometries(Qt3DCore::QNode *owner)
+  : mOwner(owner)
+  , mBillboardGeometry(nullptr)
+{
+}
+
+Qt3DRender::QGeometry *PointShapeGeometries::geometry(const QVariantMap &shapeProperties)
+{
+  // QVariantMap is sorted by keys, so equal properties give equal keys
+  QString key;
+  for (auto it = shapeProperties.constBegin(); it != shapeProperties.constEnd(); ++it)
+    key += it.key() + '=' + it.value().toString() + '\n';
+
+  Qt3DRender::QGeometry* geometry = mGeometries.value(key);
+  if (!geometry)
+  {
+    geometry = _shapeGeometry(shapeProperties);
+    geometry->setParent(mOwner);
+    mGeometries.insert(key, geometry);
+  }
+  return geometry;
+}
+
+Qt3DRender::QGeometry *PointShapeGeometries::billboardGeometry()
+{
+  if (!mBillboardGeometry)
+  {
+    mBillboardGeometry = _billboardGeometry();
+    mBillboardGeometry->setParent(mOwner);
+  }
+  return mBillboardGeometry;
+}
+
+// ---------------
+
+PointEntity::PointEntity(const Map3D& map, const PointRenderer& settings, PointShapeGeometries& shapes, Qt3DCore::QNode* parent)
+  : Qt3DCore::QEntity(parent)
+  , mBillboardDistance(settings.billboardDistance)
+  , mBillboardInstanceBuffer(nullptr)
+  , mLodValid(false)
+{
+  //
+  // load features
+  //
+
+  QgsFeature f;
+  QgsFeatureRequest request;
+  request.setDestinationCrs(map.crs, QgsCoordinateTransformContext());
+  QgsFeatureIterator fi = settings.layer()->getFeatures(request);
+  while (fi.nextFeature(f))
+  {
+    if (f.geometry().isNull())
+      continue;
+
+    const QgsAbstractGeometry* g = f.geometry().constGet();
+    if (QgsWkbTypes::flatType(g->wkbType()) == QgsWkbTypes::Point)
+    {
+      const QgsPoint* pt = static_cast<const QgsPoint*>(g);
+      // TODO: use Z coordinates if the point is 3D
+      float h = map.terrainGenerator->heightAt(pt->x(), pt->y(), map) * map.zExaggeration;
+      mPositions.append(QVector3D(pt->x() - map.originX, h + settings.height, -(pt->y() - map.originY)));
+      //qDebug() << positions.last();
+    }
+    else
+      qDebug() << "not a point";
+  }
+
+  int count = mPositions.count();
+
+  // until the first update all instances use the full geometry
+  QByteArray ba(reinterpret_cast<const char*>(mPositions.constData()), count * sizeof(QVector3D));
+
+  //
+  // one instance buffer shared by all parts
+  //
+
+  mInstanceBuffer = new Qt3DRender::QBuffer(Qt3DRender::QBuffer::VertexBuffer, this);
+  mInstanceBuffer->setData(ba);
+  Qt3DRender::QAttribute* instanceAttribute = _instanceAttribute(mInstanceBuffer);
+
+  // parts of the symbol and their billboards (billboards are only used if all parts have them)
+  struct Billboard
+  {
+    QVector3D center;
+    QVector2D halfSize;
+    BillboardType type;
+  };
+  QVector<Billboard> billboards;
+  bool useBillboards = mBillboardDistance > 0;
+
+  Q_FOREACH (const PointSymbolPart& part, settings.parts)
+  {
+    Qt3DRender::QGeometry* shape = shapes.geometry(part.shapeProperties);
+
+    Qt3DRender::QGeometryRenderer* renderer = _instancedRenderer(shape, instanceAttribute);
+    renderer->setInstanceCount(count);
+    mRenderers << renderer;
+
+    Qt3DCore::QEntity* partEntity = new Qt3DCore::QEntity(this);
+    partEntity->addComponent(renderer);
+    partEntity->addComponent(_partMaterial(part));
+
+    Billboard billboard;
+    if (useBillboards && _billboardShape(shape, part.transform, billboard.center, billboard.halfSize, billboard.type))
+      billboards << billboard;
+    else
+      useBillboards = false;
+  }
+
+  //
+  // billboards for instances far from the camera
+  //
+
+  if (useBillboards && !billboards.isEmpty())
+  {
+    mBillboardInstanceBuffer = new Qt3DRender::QBuffer(Qt3DRender::QBuffer::VertexBuffer, this);
+    Qt3DRender::QAttribute* billboardInstanceAttribute = _instanceAttribute(mBillboardInstanceBuffer);
+
+    // distance of instances from the camera is measured to the middle of all parts
+    for (int i = 0; i < billboards.count(); ++i)
+      mBillboardCenter += billboards[i].center / billboards.count();
+
+    for (int i = 0; i < billboards.count(); ++i)
+    {
+      Qt3DRender::QGeometryRenderer* renderer = _instancedRenderer(shapes.billboardGeometry(), billboardInstanceAttribute);
+      renderer->setPrimitiveType(Qt3DRender::QGeometryRenderer::TriangleStrip);
+      renderer->setInstanceCount(0);
+      mBillboardRenderers << renderer;
+
+      Qt3DRender::QMaterial* billboardMaterial = _material(settings.parts[i].material, "billboard");
+      billboardMaterial->effect()->addParameter(new Qt3DRender::QParameter(QStringLiteral("billboardCenter"), billboards[i].center));
+      billboardMaterial->effect()->addParameter(new Qt3DRender::QParameter(QStringLiteral("billboardHalfSize"), billboards[i].halfSize));
+      billboardMaterial->effect()->addParameter(new Qt3DRender::QParameter(QStringLiteral("billboardType"), int(billboards[i].type)));
+
+      Qt3DCore::QEntity* billboardEntity = new Qt3DCore::QEntity(this);
+      billboardEntity->addComponent(renderer);
+      billboardEntity->addComponent(billboardMaterial);
+    }
+  }
+}
+
+void PointEntity::update(const SceneState &state)
+{
+  if (!mBillboardInstanceBuffer)
+    return;
+
+  // no need to sort the instances again if the camera has moved just a bit
+  if (mLodValid && (state.cameraPos - mLastCameraPos).length() < mBillboardDistance * LOD_UPDATE_FRACTION)
+    return;
+  mLodValid = true;
+  mLastCameraPos = state.cameraPos;
+
+  const int count = mPositions.count();
+  const float maxDistanceSq = mBillboardDistance * mBillboardDistance;
+  QByteArray nearData(count * sizeof(QVector3D), Qt::Uninitialized);
+  QByteArray farData(count * sizeof(QVector3D), Qt::Uninitialized);
+  QVector3D* nearPtr = reinterpret_cast<QVector3D*>(nearData.data());
+  QVector3D* farPtr = reinterpret_cast<QVector3D*>(farData.data());
+  int nearCount = 0, farCount = 0;
+  for (int i = 0; i < count; ++i)
+  {
+    const QVector3D& pos = mPositions[i];
+    if ((pos + mBillboardCenter - state.cameraPos).lengthSquared() > maxDistanceSq)
+      farPtr[farCount++] = pos;
+    else
+      nearPtr[nearCount++] = pos;
+  }
+  nearData.resize(nearCount * sizeof(QVector3D));
+  farData.resize(farCount * sizeof(QVector3D));
+
+  // all parts are drawn from the same two buffers
+  mInstanceBuffer->setData(nearData);
+  Q_FOREACH (Qt3DRender::QGeometryRenderer* renderer, mRenderers)
+    renderer->setInstanceCount(nearCount);
+  mBillboardInstanceBuffer->setData(farData);
+  Q_FOREACH (Qt3DRender::QGeometryRenderer* renderer, mBillboardRenderers)
+    renderer->setInstanceCount(farCount);
 }
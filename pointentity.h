@@ -3,13 +3,68 @@
 
 #include <Qt3DCore/QEntity>
 
+#include <QHash>
+#include <QVariant>
+#include <QVector>
+#include <QVector3D>
+
 class Map3D;
 class PointRenderer;
+class SceneState;
+
+namespace Qt3DRender
+{
+  class QBuffer;
+  class QGeometry;
+  class QGeometryRenderer;
+}
+
+
+//! Shape geometries shared by point entities, so that shapes with identical properties
+//! are generated just once. Geometries are owned by the node given in the constructor
+class PointShapeGeometries
+{
+public:
+  PointShapeGeometries(Qt3DCore::QNode* owner);
+
+  //! Returns geometry of the shape with the given properties (see PointSymbolPart::shapeProperties)
+  Qt3DRender::QGeometry* geometry(const QVariantMap& shapeProperties);
+  //! Returns quad used for billboards
+  Qt3DRender::QGeometry* billboardGeometry();
 
+private:
+  Qt3DCore::QNode* mOwner;
+  QHash<QString, Qt3DRender::QGeometry*> mGeometries;
+  Qt3DRender::QGeometry* mBillboardGeometry;
+};
+
+
+//! Entity that renders point features as instances of 3D shapes - one instanced draw for each part
+//! of the symbol, all of them using the same buffer with positions. If enabled in the renderer,
+//! instances far from the camera are drawn as camera-facing billboards instead of the full geometry
 class PointEntity : public Qt3DCore::QEntity
 {
 public:
-  PointEntity(const Map3D& map, const PointRenderer& settings, Qt3DCore::QNode* parent = nullptr);
+  PointEntity(const Map3D& map, const PointRenderer& settings, PointShapeGeometries& shapes, Qt3DCore::QNode* parent = nullptr);
+
+  //! Moves instances between the full geometry and billboards based on their distance from the camera
+  void update(const SceneState& state);
+
+  //! Whether instances far from the camera get drawn as billboards
+  bool hasBillboards() const { return mBillboardInstanceBuffer != nullptr; }
+
+private:
+  QVector<QVector3D> mPositions;  //!< positions of all instances in world coordinates
+  float mBillboardDistance;       //!< distance from the camera where instances switch to billboards
+  QVector3D mBillboardCenter;     //!< middle of the parts relative to instance position
+
+  Qt3DRender::QBuffer* mInstanceBuffer;  //!< positions of instances drawn with the full geometry
+  QList<Qt3DRender::QGeometryRenderer*> mRenderers;  //!< one for each part
+  Qt3DRender::QBuffer* mBillboardInstanceBuffer;  //!< positions of instances drawn as billboards (null if disabled)
+  QList<Qt3DRender::QGeometryRenderer*> mBillboardRenderers;  //!< one for each part
+
+  bool mLodValid;             //!< whether instances have been sorted already
+  QVector3D mLastCameraPos;   //!< camera position at the time of the last sort
 };
 
 #endif // POINTENTITY_H
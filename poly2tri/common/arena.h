@@ -0,0 +1,128 @@
+/*
+ * Poly2Tri Copyright (c) 2009-2010, Poly2Tri Contributors
+ * http://code.google.com/p/poly2tri/
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * * Neither the name of Poly2Tri nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <assert.h>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+namespace p2t {
+
+/**
+ * Simple bump allocator for the triangulation's small objects (edges, triangles,
+ * advancing front nodes). Memory is only released all at once: Reset() rewinds
+ * the arena while keeping its blocks, so that triangulating many polygons one after
+ * another does not go through the general purpose heap again once warmed up.
+ *
+ * Objects are never destroyed - only use it for types with trivial destructors.
+ */
+class Arena {
+public:
+
+  Arena(size_t block_size = 64 * 1024) : block_size_(block_size), block_(0), used_(0)
+  {
+  }
+
+  ~Arena()
+  {
+    for (size_t i = 0; i < blocks_.size(); i++)
+      std::free(blocks_[i]);
+  }
+
+  /// Allocate uninitialized memory suitably aligned for any of our objects
+  void* Allocate(size_t size)
+  {
+    const size_t align = sizeof(double) > sizeof(void*) ? sizeof(double) : sizeof(void*);
+    size = (size + align - 1) & ~(align - 1);
+    assert(size <= block_size_);
+
+    if (blocks_.empty() || used_ + size > block_size_) {
+      if (!blocks_.empty())
+        block_++;
+      if (block_ == blocks_.size()) {
+        void* block = std::malloc(block_size_);
+        if (!block)
+          throw std::bad_alloc();
+        blocks_.push_back(static_cast<char*>(block));
+      }
+      used_ = 0;
+    }
+
+    void* ptr = blocks_[block_] + used_;
+    used_ += size;
+    return ptr;
+  }
+
+  template<class T, class A>
+  T* New(A& a)
+  {
+    return new (Allocate(sizeof(T))) T(a);
+  }
+
+  template<class T, class A, class B>
+  T* New(A& a, B& b)
+  {
+    return new (Allocate(sizeof(T))) T(a, b);
+  }
+
+  template<class T, class A, class B, class C>
+  T* New(A& a, B& b, C& c)
+  {
+    return new (Allocate(sizeof(T))) T(a, b, c);
+  }
+
+  /// Forget all objects allocated so far, keeping the memory for reuse
+  void Reset()
+  {
+    block_ = 0;
+    used_ = 0;
+  }
+
+private:
+
+  Arena(const Arena&);
+  Arena& operator=(const Arena&);
+
+  size_t block_size_;
+  std::vector<char*> blocks_;
+  /// Index of the block we are currently allocating from
+  size_t block_;
+  /// Bytes used in the current block
+  size_t used_;
+};
+
+}
+
+#endif
@@ -32,12 +32,23 @@
 
 namespace p2t {
 
+CDT::CDT()
+{
+  sweep_context_ = new SweepContext;
+  sweep_ = new Sweep;
+}
+
 CDT::CDT(const std::vector<Point*>& polyline)
 {
   sweep_context_ = new SweepContext(polyline);
   sweep_ = new Sweep;
 }
 
+void CDT::Reset(const std::vector<Point*>& polyline)
+{
+  sweep_context_->Reset(polyline);
+}
+
 void CDT::AddHole(const std::vector<Point*>& polyline)
 {
   sweep_context_->AddHole(polyline);
@@ -52,12 +63,12 @@ void CDT::Triangulate()
   sweep_->Triangulate(*sweep_context_);
 }
 
-std::vector<p2t::Triangle*> CDT::GetTriangles()
+std::vector<p2t::Triangle*>& CDT::GetTriangles()
 {
   return sweep_context_->GetTriangles();
 }
 
-std::list<p2t::Triangle*> CDT::GetMap()
+std::vector<p2t::Triangle*>& CDT::GetMap()
 {
   return sweep_context_->GetMap();
 }
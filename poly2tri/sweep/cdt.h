@@ -48,6 +48,11 @@ class CDT
 {
 public:
 
+  /**
+   * Constructor - empty triangulation, call Reset() to add polyline
+   */
+  CDT();
+
   /**
    * Constructor - add polyline with non repeating points
    *
@@ -55,6 +60,15 @@ public:
    */
   CDT(const std::vector<Point*>& polyline);
 
+  /**
+   * Start a new triangulation of the given polyline, reusing memory
+   * of the previous one. Triangles returned earlier become invalid.
+   * Points of the polyline must have empty edge lists.
+   *
+   * @param polyline
+   */
+  void Reset(const std::vector<Point*>& polyline);
+
    /**
    * Destructor - clean up memory
    */
@@ -82,12 +96,12 @@ public:
   /**
    * Get CDT triangles
    */
-  std::vector<Triangle*> GetTriangles();
+  std::vector<Triangle*>& GetTriangles();
 
   /**
    * Get triangle map
    */
-  std::list<Triangle*> GetMap();
+  std::vector<Triangle*>& GetMap();
 
   private:
 
@@ -34,6 +34,15 @@
 
 namespace p2t {
 
+SweepContext::SweepContext() : front_(0),
+  head_(0),
+  tail_(0),
+  af_head_(0),
+  af_middle_(0),
+  af_tail_(0)
+{
+}
+
 SweepContext::SweepContext(const std::vector<Point*>& polyline) : points_(polyline),
   front_(0),
   head_(0),
@@ -45,6 +54,24 @@ SweepContext::SweepContext(const std::vector<Point*>& polyline) : points_(polyli
   InitEdges(points_);
 }
 
+void SweepContext::Reset(const std::vector<Point*>& polyline)
+{
+  // all objects live in the arena - just forget them (clear() keeps capacity of vectors)
+  arena_.Reset();
+  edge_list.clear();
+  triangles_.clear();
+  map_.clear();
+  points_.assign(polyline.begin(), polyline.end());
+
+  front_ = 0;
+  head_ = tail_ = 0;
+  af_head_ = af_middle_ = af_tail_ = 0;
+  basin.Clear();
+  edge_event = EdgeEvent();
+
+  InitEdges(points_);
+}
+
 void SweepContext::AddHole(const std::vector<Point*>& polyline)
 {
   InitEdges(polyline);
@@ -62,7 +89,7 @@ std::vector<Triangle*> &SweepContext::GetTriangles()
   return triangles_;
 }
 
-std::list<Triangle*> &SweepContext::GetMap()
+std::vector<Triangle*> &SweepContext::GetMap()
 {
   return map_;
 }
@@ -87,8 +114,10 @@ void SweepContext::InitTriangulation()
 
   double dx = kAlpha * (xmax - xmin);
   double dy = kAlpha * (ymax - ymin);
-  head_ = new Point(xmax + dx, ymin - dy);
-  tail_ = new Point(xmin - dx, ymin - dy);
+  head_point_.set(xmax + dx, ymin - dy);
+  tail_point_.set(xmin - dx, ymin - dy);
+  head_ = &head_point_;
+  tail_ = &tail_point_;
 
   // Sort points along y-axis
   std::sort(points_.begin(), points_.end(), cmp);
@@ -100,7 +129,7 @@ void SweepContext::InitEdges(const std::vector<Point*>& polyline)
   size_t num_points = polyline.size();
   for (size_t i = 0; i < num_points; i++) {
     size_t j = i < num_points - 1 ? i + 1 : 0;
-    edge_list.push_back(new Edge(*polyline[i], *polyline[j]));
+    edge_list.push_back(arena_.New<Edge>(*polyline[i], *polyline[j]));
   }
 }
 
@@ -120,19 +149,17 @@ Node& SweepContext::LocateNode(const Point& point)
   return *front_->LocateNode(point.x);
 }
 
-void SweepContext::CreateAdvancingFront(const std::vector<Node*>& nodes)
+void SweepContext::CreateAdvancingFront()
 {
-
-  (void) nodes;
   // Initial triangle
-  Triangle* triangle = new Triangle(*points_[0], *tail_, *head_);
+  Triangle* triangle = arena_.New<Triangle>(*points_[0], *tail_, *head_);
 
   map_.push_back(triangle);
 
-  af_head_ = new Node(*triangle->GetPoint(1), *triangle);
-  af_middle_ = new Node(*triangle->GetPoint(0), *triangle);
-  af_tail_ = new Node(*triangle->GetPoint(2));
-  front_ = new AdvancingFront(*af_head_, *af_tail_);
+  af_head_ = arena_.New<Node>(*triangle->GetPoint(1), *triangle);
+  af_middle_ = arena_.New<Node>(*triangle->GetPoint(0), *triangle);
+  af_tail_ = arena_.New<Node>(*triangle->GetPoint(2));
+  front_ = arena_.New<AdvancingFront>(*af_head_, *af_tail_);
 
   // TODO: More intuitive if head is middles next and not previous?
   //       so swap head and tail
@@ -144,7 +171,8 @@ void SweepContext::CreateAdvancingFront(const std::vector<Node*>& nodes)
 
 void SweepContext::RemoveNode(Node* node)
 {
-  delete node;
+  // nodes are released together with the arena
+  (void) node;
 }
 
 void SweepContext::MapTriangleToNodes(Triangle& t)
@@ -160,12 +188,13 @@ void SweepContext::MapTriangleToNodes(Triangle& t)
 
 void SweepContext::RemoveFromMap(Triangle* triangle)
 {
-  map_.remove(triangle);
+  map_.erase(std::remove(map_.begin(), map_.end(), triangle), map_.end());
 }
 
 void SweepContext::MeshClean(Triangle& triangle)
 {
-  std::vector<Triangle *> triangles;
+  std::vector<Triangle *>& triangles = mesh_clean_stack_;
+  triangles.clear();
   triangles.push_back(&triangle);
 
   while(!triangles.empty()){
@@ -185,27 +214,7 @@ void SweepContext::MeshClean(Triangle& triangle)
 
 SweepContext::~SweepContext()
 {
-
-    // Clean up memory
-
-    delete head_;
-    delete tail_;
-    delete front_;
-    delete af_head_;
-    delete af_middle_;
-    delete af_tail_;
-
-    typedef std::list<Triangle*> type_list;
-
-    for(type_list::iterator iter = map_.begin(); iter != map_.end(); ++iter) {
-        Triangle* ptr = *iter;
-        delete ptr;
-    }
-
-     for(unsigned int i = 0; i < edge_list.size(); i++) {
-        delete edge_list[i];
-    }
-
+  // edges, triangles and advancing front are owned by the arena
 }
 
 }
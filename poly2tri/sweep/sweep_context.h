@@ -32,9 +32,10 @@
 #ifndef SWEEP_CONTEXT_H
 #define SWEEP_CONTEXT_H
 
-#include <list>
 #include <vector>
 #include <cstddef>
+#include "../common/arena.h"
+#include "../common/shapes.h"
 
 namespace p2t {
 
@@ -42,20 +43,23 @@ namespace p2t {
 // PointSet width to both left and right.
 const double kAlpha = 0.3;
 
-struct Point;
-class Triangle;
 struct Node;
-struct Edge;
 class AdvancingFront;
 
 class SweepContext {
 public:
 
+/// Constructor
+SweepContext();
 /// Constructor
 SweepContext(const std::vector<Point*>& polyline);
 /// Destructor
 ~SweepContext();
 
+/// Drop the previous triangulation and start a new one with the given polyline.
+/// Memory allocated for the previous triangulation is reused.
+void Reset(const std::vector<Point*>& polyline);
+
 void set_head(Point* p1);
 
 Point* head() const;
@@ -70,7 +74,7 @@ Node& LocateNode(const Point& point);
 
 void RemoveNode(Node* node);
 
-void CreateAdvancingFront(const std::vector<Node*>& nodes);
+void CreateAdvancingFront();
 
 /// Try to map a node to all sides of this triangle that don't have a neighbor
 void MapTriangleToNodes(Triangle& t);
@@ -92,7 +96,7 @@ AdvancingFront* front() const;
 void MeshClean(Triangle& triangle);
 
 std::vector<Triangle*> &GetTriangles();
-std::list<Triangle*> &GetMap();
+std::vector<Triangle*> &GetMap();
 
 std::vector<Edge*> edge_list;
 
@@ -133,9 +137,14 @@ private:
 
 friend class Sweep;
 
+/// Storage of edges, triangles and advancing front (released all at once)
+Arena arena_;
+
 std::vector<Triangle*> triangles_;
-std::list<Triangle*> map_;
+std::vector<Triangle*> map_;
 std::vector<Point*> points_;
+/// Work list used by MeshClean() - kept to avoid allocations
+std::vector<Triangle*> mesh_clean_stack_;
 
 // Advancing front
 AdvancingFront* front_;
@@ -143,6 +152,8 @@ AdvancingFront* front_;
 Point* head_;
 // tail point used with advancing front
 Point* tail_;
+// storage for head and tail points
+Point head_point_, tail_point_;
 
 Node *af_head_, *af_middle_, *af_tail_;
 
@@ -0,0 +1,223 @@
+#include "polygonchunkloader.h"
+
+#include "chunknode.h"
+#include "polygongeometry.h"
+#include "terraingenerator.h"
+#include "utils.h"
+
+#include <Qt3DExtras/QPhongMaterial>
+#include <Qt3DRender/QGeometryRenderer>
+
+#include "qgscoordinatetransform.h"
+#include "qgsmultipolygon.h"
+#include "qgsvectorlayer.h"
+#include "qgsvectorlayerfeatureiterator.h"
+
+
+//! average number of features in tiles at the deepest level
+static const int FEATURES_PER_LEAF_TILE = 1000;
+//! root error is the size of a "pixel" when the root tile is rendered with this resolution
+static const int ROOT_TILE_RESOLUTION = 256;
+
+
+//! each feature is in exactly one tile of a level - the one with the center of its bounding box
+static bool _isInTile(const QgsPointXY& pt, const QgsRectangle& extent)
+{
+  return pt.x() >= extent.xMinimum() && pt.x() < extent.xMaximum() &&
+         pt.y() >= extent.yMinimum() && pt.y() < extent.yMaximum();
+}
+
+static void _addPolygon(Tessellator& tessellator, const QgsPolygon* polygon, const PolygonRenderer& settings, const Map3D& map)
+{
+  QgsPolygon* polyClone = polygon->clone();
+  Utils::clampAltitudes(polyClone, settings.altClamping, settings.altBinding, settings.height, map);
+  tessellator.addPolygon(*polyClone, settings.extrusionHeight);
+  delete polyClone;
+}
+
+
+PolygonChunkLoader::PolygonChunkLoader(const Map3D &map, const PolygonRenderer &settings, const QSharedPointer<QgsAbstractFeatureSource> &source,
+                                       const QgsRectangle &extent, bool leaf, ChunkNode *node)
+  : ChunkLoader(node)
+  , map(map)
+  , settings(settings)
+  , source(source)
+  , extent(extent)
+  , leaf(leaf)
+{
+}
+
+void PolygonChunkLoader::load()
+{
+  // details smaller than the error of the tile would not be visible
+  const double tolerance = leaf ? 0 : node->error;
+
+  Tessellator tessellator(map.originX, map.originY, true);
+
+  QgsFeature f;
+  QgsFeatureRequest request;
+  request.setDestinationCrs(map.crs, QgsCoordinateTransformContext());
+  request.setFilterRect(extent);
+  request.setSubsetOfAttributes(QgsAttributeList());
+  QgsFeatureIterator fi = source->getFeatures(request);
+  while (fi.nextFeature(f))
+  {
+    if (f.geometry().isNull())
+      continue;
+
+    QgsRectangle bbox = f.geometry().boundingBox();
+    if (!_isInTile(bbox.center(), extent))
+      continue;
+
+    QgsGeometry geom = f.geometry();
+    if (tolerance > 0)
+    {
+      if (bbox.width() < 2 * tolerance && bbox.height() < 2 * tolerance)
+        continue;  // just a couple of pixels on the screen
+      geom = geom.simplify(tolerance);
+      if (geom.isNull())
+        continue;
+    }
+
+    const QgsAbstractGeometry* g = geom.constGet();
+    if (QgsWkbTypes::flatType(g->wkbType()) == QgsWkbTypes::Polygon)
+    {
+      _addPolygon(tessellator, static_cast<const QgsPolygon*>(g), settings, map);
+    }
+    else if (QgsWkbTypes::flatType(g->wkbType()) == QgsWkbTypes::MultiPolygon)
+    {
+      const QgsMultiPolygon* mpoly = static_cast<const QgsMultiPolygon*>(g);
+      for (int i = 0; i < mpoly->numGeometries(); ++i)
+      {
+        const QgsAbstractGeometry* g2 = mpoly->geometryN(i);
+        Q_ASSERT(QgsWkbTypes::flatType(g2->wkbType()) == QgsWkbTypes::Polygon);
+        _addPolygon(tessellator, static_cast<const QgsPolygon*>(g2), settings, map);
+      }
+    }
+  }
+
+  mesh.data = tessellator.data;
+  mesh.indices = tessellator.indices;
+
+  // bounds of the mesh (vertices are x,y,z followed by normal)
+  const int floatsPerVertex = tessellator.stride / sizeof(float);
+  for (int i = 0; i < tessellator.vertexCount(); ++i)
+  {
+    const float* v = mesh.data.constData() + i * floatsPerVertex;
+    if (i == 0)
+      meshBbox = AABB(v[0], v[1], v[2], v[0], v[1], v[2]);
+    else
+    {
+      meshBbox.xMin = qMin(meshBbox.xMin, v[0]); meshBbox.xMax = qMax(meshBbox.xMax, v[0]);
+      meshBbox.yMin = qMin(meshBbox.yMin, v[1]); meshBbox.yMax = qMax(meshBbox.yMax, v[1]);
+      meshBbox.zMin = qMin(meshBbox.zMin, v[2]); meshBbox.zMax = qMax(meshBbox.zMax, v[2]);
+    }
+  }
+}
+
+Qt3DCore::QEntity *PolygonChunkLoader::createEntity(Qt3DCore::QEntity *parent)
+{
+  Qt3DCore::QEntity* entity = new Qt3DCore::QEntity;
+
+  if (!mesh.indices.isEmpty())
+  {
+    Qt3DExtras::QPhongMaterial* material = new Qt3DExtras::QPhongMaterial;
+    material->setAmbient(settings.material.ambient());
+    material->setDiffuse(settings.material.diffuse());
+    material->setSpecular(settings.material.specular());
+    material->setShininess(settings.material.shininess());
+    entity->addComponent(material);
+
+    PolygonGeometry* geometry = new PolygonGeometry;
+    geometry->setMeshes(QVector<TessellatedMesh>() << mesh);
+
+    Qt3DRender::QGeometryRenderer* renderer = new Qt3DRender::QGeometryRenderer;
+    renderer->setGeometry(geometry);
+    entity->addComponent(renderer);
+
+    // features assigned to the tile may stick out of it - the box must contain them (but not shrink the tile).
+    // Heights are only widened too: small features left for the children may lie outside of our mesh's
+    // height range, and children get their heights clamped to our box until they are loaded
+    AABB bbox = node->bbox;
+    bbox.xMin = qMin(bbox.xMin, meshBbox.xMin); bbox.xMax = qMax(bbox.xMax, meshBbox.xMax);
+    bbox.yMin = qMin(bbox.yMin, meshBbox.yMin); bbox.yMax = qMax(bbox.yMax, meshBbox.yMax);
+    bbox.zMin = qMin(bbox.zMin, meshBbox.zMin); bbox.zMax = qMax(bbox.zMax, meshBbox.zMax);
+    node->setExactBbox(bbox);
+  }
+
+  entity->setEnabled(false);
+  entity->setParent(parent);
+  return entity;
+}
+
+// ---------------
+
+PolygonChunkLoaderFactory::PolygonChunkLoaderFactory(const Map3D &map, const PolygonRenderer &settings)
+  : map(map)
+  , settings(settings)
+  , maxLevel(0)
+{
+  QgsVectorLayer* layer = settings.layer();
+  QgsCoordinateTransform layerToMapTransform(layer->crs(), map.crs);
+  QgsRectangle extent = layerToMapTransform.transformBoundingBox(layer->extent());
+  tilingScheme = TilingScheme(extent, map.crs);
+
+  // go deep enough so that the tiles of the deepest level do not have too many features
+  long featureCount = layer->featureCount();
+  while (maxLevel < 12 && featureCount > FEATURES_PER_LEAF_TILE * pow(4, maxLevel))
+    ++maxLevel;
+
+  source.reset(new QgsVectorLayerFeatureSource(layer));
+
+  // terrain generators may prepare data for height queries on the first use - better to do it here
+  // in the main thread than to have loaders doing it (heights are queried when clamping to terrain)
+  if (settings.altClamping != AltClampAbsolute)
+  {
+    QgsPointXY center = extent.center();
+    map.terrainGenerator->heightAt(center.x(), center.y(), map);
+  }
+}
+
+ChunkLoader *PolygonChunkLoaderFactory::createChunkLoader(ChunkNode *node) const
+{
+  QgsRectangle extent = tilingScheme.tileToExtent(node->x, node->y, node->z);
+  return new PolygonChunkLoader(map, settings, source, extent, node->z >= maxLevel, node);
+}
+
+AABB PolygonChunkLoaderFactory::rootChunkBbox() const
+{
+  QgsRectangle extent = tilingScheme.tileToExtent(0, 0, 0);
+
+  // the real range is only known once tiles get loaded
+  float hMin, hMax;
+  map.terrainGenerator->rootChunkHeightRange(hMin, hMax);
+  hMin = hMin * map.zExaggeration + settings.height;
+  hMax = hMax * map.zExaggeration + settings.height + settings.extrusionHeight;
+
+  return AABB(extent.xMinimum() - map.originX, hMin, -extent.yMaximum() + map.originY,
+              extent.xMaximum() - map.originX, hMax, -extent.yMinimum() + map.originY);
+}
+
+float PolygonChunkLoaderFactory::rootChunkError() const
+{
+  return tilingScheme.baseTileSide / ROOT_TILE_RESOLUTION;
+}
+
+// ---------------
+
+PolygonChunkedEntity::PolygonChunkedEntity(const Map3D &map, const PolygonRenderer &settings, Qt3DCore::QNode *parent)
+  : PolygonChunkedEntity(new PolygonChunkLoaderFactory(map, settings), parent)
+{
+}
+
+PolygonChunkedEntity::PolygonChunkedEntity(PolygonChunkLoaderFactory *factory, Qt3DCore::QNode *parent)
+  : ChunkedEntity(factory->rootChunkBbox(), factory->rootChunkError(), factory->map.maxTerrainError, factory->maxLevel, factory, parent)
+  , mFactory(factory)
+{
+}
+
+PolygonChunkedEntity::~PolygonChunkedEntity()
+{
+  // loaders that may still be running do not use the factory
+  delete mFactory;
+}
@@ -0,0 +1,80 @@
+#ifndef POLYGONCHUNKLOADER_H
+#define POLYGONCHUNKLOADER_H
+
+#include "chunkedentity.h"
+#include "chunkloader.h"
+
+#include <QSharedPointer>
+
+#include "aabb.h"
+#include "map3d.h"
+#include "tessellator.h"
+#include "tilingscheme.h"
+
+class QgsAbstractFeatureSource;
+
+
+//! Loads polygons of one tile: features are fetched, simplified and tessellated in the worker thread.
+//! Coarse levels skip features that are too small to be seen and simplify the others by the tile's error
+class PolygonChunkLoader : public ChunkLoader
+{
+public:
+  PolygonChunkLoader(const Map3D& map, const PolygonRenderer& settings, const QSharedPointer<QgsAbstractFeatureSource>& source,
+                     const QgsRectangle& extent, bool leaf, ChunkNode* node);
+
+  virtual void load() override;
+
+  virtual Qt3DCore::QEntity* createEntity(Qt3DCore::QEntity* parent) override;
+
+private:
+  // everything except the map is copied so that the loader does not depend on the factory while loading
+  // (the map outlives the entity and its loaders)
+  const Map3D& map;
+  PolygonRenderer settings;
+  QSharedPointer<QgsAbstractFeatureSource> source;
+  QgsRectangle extent;  //!< extent of the tile in map CRS
+  bool leaf;            //!< whether this is the most detailed level (nothing gets simplified)
+
+  TessellatedMesh mesh;
+  AABB meshBbox;        //!< bounds of the mesh in world coordinates (only valid if the mesh is not empty)
+};
+
+
+//! Creates loaders for tiles of a polygon layer. Tiles follow a tiling scheme
+//! with level 0 tile covering the whole extent of the layer
+class PolygonChunkLoaderFactory : public ChunkLoaderFactory
+{
+public:
+  //! Must be created in the main thread (a copy of the layer's data source is made)
+  PolygonChunkLoaderFactory(const Map3D& map, const PolygonRenderer& settings);
+
+  virtual ChunkLoader* createChunkLoader(ChunkNode* node) const override;
+
+  //! Bounding box of the root chunk in world coordinates
+  AABB rootChunkBbox() const;
+  //! Error of the root chunk in world coordinates
+  float rootChunkError() const;
+
+  const Map3D& map;
+  PolygonRenderer settings;
+  TilingScheme tilingScheme;  //!< in map CRS
+  int maxLevel;               //!< deepest level of the quadtree
+  QSharedPointer<QgsAbstractFeatureSource> source;  //!< thread-safe access to the layer's features
+};
+
+
+//! Entity that streams polygons of a layer by tiles with level of detail,
+//! so that layers with a huge number of features do not need to be fully in memory
+class PolygonChunkedEntity : public ChunkedEntity
+{
+public:
+  PolygonChunkedEntity(const Map3D& map, const PolygonRenderer& settings, Qt3DCore::QNode* parent = nullptr);
+  ~PolygonChunkedEntity();
+
+private:
+  PolygonChunkedEntity(PolygonChunkLoaderFactory* factory, Qt3DCore::QNode* parent);
+
+  PolygonChunkLoaderFactory* mFactory;
+};
+
+#endif // POLYGONCHUNKLOADER_H
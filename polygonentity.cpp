@@ -2,6 +2,7 @@
 
 #include "polygongeometry.h"
 #include "map3d.h"
+#include "tessellationcache.h"
 #include "terraingenerator.h"
 #include "utils.h"
 
@@ -27,7 +28,17 @@ PolygonEntity::PolygonEntity(const Map3D& map, const PolygonRenderer& settings,
   material->setShininess(settings.material.shininess());
   addComponent(material);
 
+  geometry = new PolygonGeometry;
+
+  // features that have not changed since the last time are taken from the cache as they are,
+  // only the others get clamped and tessellated (all of them at once in parallel)
+  TessellationCache cache(TessellationCache::defaultDirectory(), TessellationCache::polygonRendererKey(map, settings));
+  QVector<TessellatedMesh> meshes;
   QList<QgsPolygon*> polygons;
+  QVector<int> groupStart(1, 0);
+  QVector<QgsFeatureId> newFids;
+  QVector<QByteArray> newHashes;
+
   QgsFeature f;
   QgsFeatureRequest request;
   request.setDestinationCrs(map.crs, QgsCoordinateTransformContext());
@@ -37,6 +48,14 @@ PolygonEntity::PolygonEntity(const Map3D& map, const PolygonRenderer& settings,
     if (f.geometry().isNull())
       continue;
 
+    QByteArray geometryHash = TessellationCache::geometryHash(f.geometry());
+    TessellatedMesh mesh;
+    if (cache.mesh(f.id(), geometryHash, mesh))
+    {
+      meshes << mesh;
+      continue;
+    }
+
     const QgsAbstractGeometry* g = f.geometry().constGet();
 
     if (QgsWkbTypes::flatType(g->wkbType()) == QgsWkbTypes::Polygon)
@@ -59,11 +78,24 @@ PolygonEntity::PolygonEntity(const Map3D& map, const PolygonRenderer& settings,
       }
     }
     else
+    {
       qDebug() << "not a polygon";
+      continue;
+    }
+
+    groupStart << polygons.count();
+    newFids << f.id();
+    newHashes << geometryHash;
   }
 
-  geometry = new PolygonGeometry;
-  geometry->setPolygons(polygons, origin, settings.extrusionHeight);
+  QVector<TessellatedMesh> newMeshes = geometry->tessellate(polygons, groupStart, origin, settings.extrusionHeight);
+  for (int i = 0; i < newMeshes.count(); ++i)
+    cache.addMesh(newFids[i], newHashes[i], newMeshes[i]);
+  cache.save();
+  qDeleteAll(polygons);
+
+  meshes += newMeshes;
+  geometry->setMeshes(meshes);
 
   Qt3DRender::QGeometryRenderer* renderer = new Qt3DRender::QGeometryRenderer;
   renderer->setGeometry(geometry);
@@ -3,6 +3,8 @@
 #include <Qt3DRender/QAttribute>
 #include <Qt3DRender/QBuffer>
 #include <Qt3DRender/QBufferDataGenerator>
+#include <QThread>
+#include <QtConcurrent/QtConcurrentRun>
 
 #include "tessellator.h"
 
@@ -14,10 +16,12 @@ PolygonGeometry::PolygonGeometry(QNode *parent)
   : Qt3DRender::QGeometry(parent)
   , m_positionAttribute(nullptr)
   , m_normalAttribute(nullptr)
+  , m_indexAttribute(nullptr)
 {
   m_withNormals = true;
 
   m_vertexBuffer = new Qt3DRender::QBuffer(Qt3DRender::QBuffer::VertexBuffer, this);
+  m_indexBuffer = new Qt3DRender::QBuffer(Qt3DRender::QBuffer::IndexBuffer, this);
 
   Tessellator tmpTess(0, 0, m_withNormals);
   const int stride = tmpTess.stride;
@@ -53,6 +57,12 @@ PolygonGeometry::PolygonGeometry(QNode *parent)
     m_normalAttribute->setByteOffset(3 * sizeof(float));
     addAttribute(m_normalAttribute);
   }
+
+  // index type (16 or 32 bit) is decided in setMeshes() based on number of vertices
+  m_indexAttribute = new Qt3DRender::QAttribute(this);
+  m_indexAttribute->setAttributeType(Qt3DRender::QAttribute::IndexAttribute);
+  m_indexAttribute->setBuffer(m_indexBuffer);
+  addAttribute(m_indexAttribute);
 }
 
 PolygonGeometry::~PolygonGeometry()
@@ -60,24 +70,147 @@ PolygonGeometry::~PolygonGeometry()
   qDeleteAll(mPolygons);
 }
 
+//! tessellates groups [first, last) with its own tessellator - may run in a worker thread.
+//! With "merge" all the groups end up in a single mesh, otherwise there is one mesh for each group
+static QVector<TessellatedMesh> _tessellate(const QList<QgsPolygon*>& polygons, const QVector<int>& groupStart, int first, int last, bool merge, const QgsPointXY& origin, bool withNormals, float extrusionHeight)
+{
+  QVector<TessellatedMesh> meshes;
+  Tessellator tesselator(origin.x(), origin.y(), withNormals);
+  for (int g = first; g < last; ++g)
+  {
+    for (int i = groupStart[g]; i < groupStart[g+1]; ++i)
+      tesselator.addPolygon(*polygons[i], extrusionHeight);
+
+    if (!merge)
+    {
+      TessellatedMesh mesh;
+      mesh.data = tesselator.data;
+      mesh.indices = tesselator.indices;
+      meshes << mesh;
+      tesselator.data.clear();
+      tesselator.indices.clear();
+    }
+  }
+
+  if (merge)
+  {
+    TessellatedMesh mesh;
+    mesh.data = tesselator.data;
+    mesh.indices = tesselator.indices;
+    meshes << mesh;
+  }
+  return meshes;
+}
+
+//! tessellates groups of polygons using all cores - see _tessellate()
+static QVector<TessellatedMesh> _tessellateParallel(const QList<QgsPolygon*>& polygons, const QVector<int>& groupStart, bool merge, const QgsPointXY& origin, bool withNormals, float extrusionHeight)
+{
+  const int groups = groupStart.count() - 1;
+
+  // split groups to contiguous ranges with similar number of vertices - one range per thread
+  // (not worth it for a handful of polygons)
+  const int threads = polygons.count() < 100 ? 1 : qMax(1, QThread::idealThreadCount());
+  qint64 totalPoints = 0;
+  Q_FOREACH (QgsPolygon* polygon, polygons)
+    totalPoints += polygon->nCoordinates();
+
+  QVector<int> rangeStart(1, 0);
+  qint64 points = 0;
+  for (int g = 0; g < groups; ++g)
+  {
+    for (int i = groupStart[g]; i < groupStart[g+1]; ++i)
+      points += polygons[i]->nCoordinates();
+    if (rangeStart.count() < threads && points * threads >= totalPoints * rangeStart.count())
+      rangeStart << g + 1;
+  }
+  if (rangeStart.last() != groups)
+    rangeStart << groups;
+  const int ranges = rangeStart.count() - 1;
+
+  // tessellate the first range in this thread while the others are processed in the pool
+  QVector< QFuture< QVector<TessellatedMesh> > > futures;
+  for (int r = 1; r < ranges; ++r)
+  {
+    int first = rangeStart[r], last = rangeStart[r+1];
+    futures << QtConcurrent::run([&polygons, &groupStart, first, last, merge, origin, withNormals, extrusionHeight]
+    {
+      return _tessellate(polygons, groupStart, first, last, merge, origin, withNormals, extrusionHeight);
+    });
+  }
+
+  QVector<TessellatedMesh> meshes = _tessellate(polygons, groupStart, 0, ranges > 0 ? rangeStart[1] : 0, merge, origin, withNormals, extrusionHeight);
+  for (int r = 0; r < futures.count(); ++r)
+    meshes += futures[r].result();
+  return meshes;
+}
+
+//! copies indices to a buffer of the given type, shifting them by the base vertex index
+template<typename T>
+static void _copyIndices(T* dst, const QVector<quint32>& indices, quint32 baseVertex)
+{
+  const quint32* src = indices.constData();
+  for (int i = 0; i < indices.count(); ++i)
+    dst[i] = T(src[i] + baseVertex);
+}
+
 void PolygonGeometry::setPolygons(const QList<QgsPolygon*> &polygons, const QgsPointXY& origin, float extrusionHeight)
 {
   qDeleteAll(mPolygons);
   mPolygons = polygons;
 
-  int i = 0;
-  Tessellator tesselator(origin.x(), origin.y(), m_withNormals);
-  Q_FOREACH (QgsPolygon* polygon, polygons)
+  // every polygon is a group on its own, but there is just one mesh for each thread
+  QVector<int> groupStart(polygons.count() + 1);
+  for (int i = 0; i <= polygons.count(); ++i)
+    groupStart[i] = i;
+
+  setMeshes(_tessellateParallel(polygons, groupStart, true, origin, m_withNormals, extrusionHeight));
+}
+
+QVector<TessellatedMesh> PolygonGeometry::tessellate(const QList<QgsPolygon*>& polygons, const QVector<int>& groupStart, const QgsPointXY& origin, float extrusionHeight) const
+{
+  return _tessellateParallel(polygons, groupStart, false, origin, m_withNormals, extrusionHeight);
+}
+
+void PolygonGeometry::setMeshes(const QVector<TessellatedMesh>& meshes)
+{
+  const int floatsPerVertex = m_positionAttribute->byteStride() / sizeof(float);
+
+  // concatenate the meshes: offsets of each mesh are the sums of sizes of the preceding ones
+  QVector<int> dataOffsets(meshes.count() + 1, 0), indexOffsets(meshes.count() + 1, 0);
+  for (int m = 0; m < meshes.count(); ++m)
   {
-    tesselator.addPolygon(*polygon, extrusionHeight);
-    ++i;
+    dataOffsets[m+1] = dataOffsets[m] + meshes[m].data.count();
+    indexOffsets[m+1] = indexOffsets[m] + meshes[m].indices.count();
   }
 
-  QByteArray data((const char*)tesselator.data.constData(), tesselator.data.count() * sizeof(float));
-  int nVerts = data.count() / tesselator.stride;
+  QByteArray data(dataOffsets.last() * sizeof(float), Qt::Uninitialized);
+  float* dataPtr = reinterpret_cast<float*>(data.data());
+  for (int m = 0; m < meshes.count(); ++m)
+    memcpy(dataPtr + dataOffsets[m], meshes[m].data.constData(), meshes[m].data.count() * sizeof(float));
+
+  // 16-bit indices are enough for most geometries and take half of the memory
+  const int nVerts = dataOffsets.last() / floatsPerVertex;
+  const bool shortIndices = nVerts <= 65536;
+  QByteArray indexData(indexOffsets.last() * (shortIndices ? sizeof(quint16) : sizeof(quint32)), Qt::Uninitialized);
+  for (int m = 0; m < meshes.count(); ++m)
+  {
+    quint32 baseVertex = dataOffsets[m] / floatsPerVertex;
+    if (shortIndices)
+      _copyIndices(reinterpret_cast<quint16*>(indexData.data()) + indexOffsets[m], meshes[m].indices, baseVertex);
+    else
+      _copyIndices(reinterpret_cast<quint32*>(indexData.data()) + indexOffsets[m], meshes[m].indices, baseVertex);
+  }
 
   m_vertexBuffer->setData(data);
   m_positionAttribute->setCount(nVerts);
   if (m_normalAttribute)
     m_normalAttribute->setCount(nVerts);
+
+  m_indexBuffer->setData(indexData);
+#if QT_VERSION >= 0x050800
+  m_indexAttribute->setVertexBaseType(shortIndices ? Qt3DRender::QAttribute::UnsignedShort : Qt3DRender::QAttribute::UnsignedInt);
+#else
+  m_indexAttribute->setDataType(shortIndices ? Qt3DRender::QAttribute::UnsignedShort : Qt3DRender::QAttribute::UnsignedInt);
+#endif
+  m_indexAttribute->setCount(indexOffsets.last());
 }
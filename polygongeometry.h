@@ -2,6 +2,7 @@
 #define POLYGONGEOMETRY_H
 
 #include "qgspolygon.h"
+#include "tessellator.h"
 
 #include <Qt3DRender/QGeometry>
 
@@ -19,12 +20,21 @@ public:
   // takes ownership of passed polygon geometries
   void setPolygons(const QList<QgsPolygon*>& polygons, const QgsPointXY& origin, float extrusionHeight);
 
+  //! Tessellates groups of polygons (e.g. parts of a feature) in parallel and returns one mesh for each group.
+  //! Group i consists of polygons[groupStart[i]] ... polygons[groupStart[i+1]-1]. Does not take ownership of polygons
+  QVector<TessellatedMesh> tessellate(const QList<QgsPolygon*>& polygons, const QVector<int>& groupStart, const QgsPointXY& origin, float extrusionHeight) const;
+
+  //! Uses already tessellated meshes (created by tessellate() of a geometry with the same normals setting)
+  void setMeshes(const QVector<TessellatedMesh>& meshes);
+
 private:
   QList<QgsPolygon*> mPolygons;
 
   Qt3DRender::QAttribute *m_positionAttribute;
   Qt3DRender::QAttribute *m_normalAttribute;
+  Qt3DRender::QAttribute *m_indexAttribute;
   Qt3DRender::QBuffer *m_vertexBuffer;
+  Qt3DRender::QBuffer *m_indexBuffer;
 
   bool m_withNormals;
 };
@@ -7,17 +7,22 @@ SOURCES += main.cpp \
     cameracontroller.cpp \
     window3d.cpp \
     sidepanel.cpp \
+    maptexturecache.cpp \
     maptexturegenerator.cpp \
     maptextureimage.cpp \
+    mipmapgenerator.cpp \
     terrain.cpp \
     tilingscheme.cpp \
     quantizedmeshgeometry.cpp \
+    tilearchive.cpp \
+    tilefetcher.cpp \
     map3d.cpp \
     terrainboundsentity.cpp \
     flatterraingenerator.cpp \
     demterraingenerator.cpp \
     quantizedmeshterraingenerator.cpp \
     terraingenerator.cpp \
+    terraintexturearray.cpp \
     demterraintilegeometry.cpp \
     poly2tri/common/shapes.cc \
     poly2tri/sweep/advancing_front.cc \
@@ -25,7 +30,9 @@ SOURCES += main.cpp \
     poly2tri/sweep/sweep_context.cc \
     poly2tri/sweep/sweep.cc \
     tessellator.cpp \
+    tessellationcache.cpp \
     polygongeometry.cpp \
+    polygonchunkloader.cpp \
     polygonentity.cpp \
     pointentity.cpp \
     scene.cpp \
@@ -36,6 +43,7 @@ SOURCES += main.cpp \
     testchunkloader.cpp \
     chunkloader.cpp \
     terrainchunkloader.cpp \
+    texturecompression.cpp \
     utils.cpp
 
 RESOURCES += qml.qrc \
@@ -85,11 +93,15 @@ HEADERS += \
     cameracontroller.h \
     window3d.h \
     sidepanel.h \
+    maptexturecache.h \
     maptexturegenerator.h \
     maptextureimage.h \
+    mipmapgenerator.h \
     terrain.h \
     tilingscheme.h \
     quantizedmeshgeometry.h \
+    tilearchive.h \
+    tilefetcher.h \
     map3d.h \
     terrainboundsentity.h \
     aabb.h \
@@ -97,8 +109,10 @@ HEADERS += \
     demterraingenerator.h \
     quantizedmeshterraingenerator.h \
     terraingenerator.h \
+    terraintexturearray.h \
     demterraintilegeometry.h \
     poly2tri/poly2tri.h \
+    poly2tri/common/arena.h \
     poly2tri/common/shapes.h \
     poly2tri/common/utils.h \
     poly2tri/sweep/advancing_front.h \
@@ -106,7 +120,9 @@ HEADERS += \
     poly2tri/sweep/sweep_context.h \
     poly2tri/sweep/sweep.h \
     tessellator.h \
+    tessellationcache.h \
     polygongeometry.h \
+    polygonchunkloader.h \
     polygonentity.h \
     pointentity.h \
     scene.h \
@@ -117,4 +133,5 @@ HEADERS += \
     testchunkloader.h \
     chunkloader.h \
     terrainchunkloader.h \
+    texturecompression.h \
     utils.h
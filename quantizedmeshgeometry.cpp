@@ -2,22 +2,32 @@
 
 #include <zlib.h>
 
-#include <QFile>
 #include <QByteArray>
+#include <QGlobalStatic>
 
 
 // gzip decompression snipped from https://stackoverflow.com/questions/2690328/qt-quncompress-gzip-data
 
 #define GZIP_WINDOWS_BIT 15 + 16
-#define GZIP_CHUNK_SIZE 32 * 1024
+
+//! deflate can't compress better than about 1:1032, so larger size hints must be corrupted
+static const qint64 GZIP_MAX_RATIO = 1032;
+//! uncompressed tiles are never this big - stop instead of eating all the memory
+static const qint64 GZIP_MAX_OUTPUT_SIZE = 256 * 1024 * 1024;
+//! the smallest step when growing the output buffer
+static const int GZIP_MIN_OUTPUT_STEP = 64 * 1024;
 
 /**
  * @brief Decompresses the given buffer using the standard GZIP algorithm
  * @param input The buffer to be decompressed
  * @param output The result of the decompression
  * @return @c true if the decompression was successfull, @c false otherwise
+ *
+ * The output buffer is allocated just once using the uncompressed size stored
+ * in the gzip trailer (bounded by the best possible compression ratio and a hard cap)
+ * and the whole input is inflated in a single pass.
  */
-bool gzipDecompress(QByteArray input, QByteArray &output)
+bool gzipDecompress(const QByteArray& input, QByteArray &output)
 {
   // Prepare output
   output.clear();
@@ -26,122 +36,171 @@ bool gzipDecompress(QByteArray input, QByteArray &output)
   if (input.isEmpty())
     return true;
 
+  // the last four bytes of gzip stream contain size of the uncompressed data
+  // (modulo 2^32, little endian) - it is just a hint, we grow the buffer if it is wrong
+  // and do not trust it more than what the compression could possibly achieve
+  qint64 sizeHint = 0;
+  if (input.size() >= 18)   // 10 bytes header + 8 bytes trailer
+  {
+    const uchar* trailer = (const uchar*) input.constData() + input.size() - 4;
+    sizeHint = quint32(trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | (trailer[3] << 24));
+  }
+  if (sizeHint <= 0)
+    sizeHint = qint64(input.size()) * 4;
+  sizeHint = qMin(sizeHint, qMin(qint64(input.size()) * GZIP_MAX_RATIO, GZIP_MAX_OUTPUT_SIZE));
+  output.resize(qMax(int(sizeHint), GZIP_MIN_OUTPUT_STEP));
+
   // Prepare inflater status
   z_stream strm;
   strm.zalloc = Z_NULL;
   strm.zfree = Z_NULL;
   strm.opaque = Z_NULL;
-  strm.avail_in = 0;
-  strm.next_in = Z_NULL;
+  strm.next_in = (unsigned char*) input.constData();
+  strm.avail_in = input.size();
 
   // Initialize inflater
-  int ret = inflateInit2(&strm, GZIP_WINDOWS_BIT);
-
-  if (ret != Z_OK)
-      return false;
-
-  // Extract pointer to input data
-  const char *input_data = input.constData();
-  int input_data_left = input.length();
-
-  // Decompress data until available
-  do {
-    // Determine current chunk size
-    int chunk_size = qMin(GZIP_CHUNK_SIZE, input_data_left);
-
-    // Check for termination
-    if (chunk_size <= 0)
-        break;
-
-    // Set inflater references
-    strm.next_in = (unsigned char*)input_data;
-    strm.avail_in = chunk_size;
+  if (inflateInit2(&strm, GZIP_WINDOWS_BIT) != Z_OK)
+    return false;
 
-    // Update interval variables
-    input_data += chunk_size;
-    input_data_left -= chunk_size;
-
-    // Inflate chunk and cumulate output
-    do {
-
-      // Declare vars
-      char out[GZIP_CHUNK_SIZE];
-
-      // Set inflater references
-      strm.next_out = (unsigned char*)out;
-      strm.avail_out = GZIP_CHUNK_SIZE;
-
-      // Try to inflate chunk
-      ret = inflate(&strm, Z_NO_FLUSH);
+  int ret;
+  while (1)
+  {
+    strm.next_out = (unsigned char*) output.data() + strm.total_out;
+    strm.avail_out = output.size() - strm.total_out;
 
-      switch (ret) {
-      case Z_NEED_DICT:
-          ret = Z_DATA_ERROR;
-      case Z_DATA_ERROR:
-      case Z_MEM_ERROR:
-      case Z_STREAM_ERROR:
-          // Clean-up
-          inflateEnd(&strm);
+    ret = inflate(&strm, Z_FINISH);
+    if (ret == Z_STREAM_END)
+      break;
 
-          // Return
-          return(false);
+    if ((ret == Z_OK || ret == Z_BUF_ERROR) && strm.avail_out == 0)
+    {
+      // the size hint was wrong - make more space and continue
+      qint64 newSize = qMax(qint64(output.size()) * 2, qint64(output.size()) + GZIP_MIN_OUTPUT_STEP);
+      if (newSize <= GZIP_MAX_OUTPUT_SIZE)
+      {
+        output.resize(int(newSize));
+        continue;
       }
+      // the output would be too big - treat it as an error
+    }
 
-      // Determine decompressed size
-      int have = (GZIP_CHUNK_SIZE - strm.avail_out);
+    // Z_NEED_DICT, Z_DATA_ERROR, Z_MEM_ERROR, Z_STREAM_ERROR, truncated input or too big output
+    inflateEnd(&strm);
+    output.clear();
+    return false;
+  }
 
-      // Cumulate result
-      if(have > 0)
-          output.append((char*)out, have);
+  output.resize(strm.total_out);
+  inflateEnd(&strm);
+  return true;
+}
 
-    } while (strm.avail_out == 0);
 
-  } while (ret != Z_STREAM_END);
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-  // Clean-up
-  inflateEnd(&strm);
+/**
+ * Decodes an array of zig-zag encoded 16-bit deltas and accumulates them,
+ * i.e. out[i] = out[i-1] + zigzag_decode(in[i]). With SSE2 eight values are decoded at once
+ * and the running sum is calculated as a prefix sum within the vector register.
+ * Returns pointer to data right after the decoded array.
+ */
+const char* read_zigzag_encoded_delta_int16_array(const char* dataPtr, int count, qint16* out)
+{
+  int i = 0;
+  qint16 value = 0;
+
+#ifdef __SSE2__
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i one = _mm_set1_epi16(1);
+  __m128i carry = zero;   // last decoded value broadcast to all lanes
+  for (; i + 8 <= count; i += 8)
+  {
+    __m128i encoded = _mm_loadu_si128((const __m128i*)(dataPtr + i*2));
+    // zig-zag: (encoded >> 1) ^ -(encoded & 1)
+    __m128i d = _mm_xor_si128(_mm_srli_epi16(encoded, 1), _mm_sub_epi16(zero, _mm_and_si128(encoded, one)));
+    // prefix sum of deltas in log2(8) steps
+    d = _mm_add_epi16(d, _mm_slli_si128(d, 2));
+    d = _mm_add_epi16(d, _mm_slli_si128(d, 4));
+    d = _mm_add_epi16(d, _mm_slli_si128(d, 8));
+    d = _mm_add_epi16(d, carry);
+    _mm_storeu_si128((__m128i*)(out + i), d);
+    carry = _mm_shufflehi_epi16(d, _MM_SHUFFLE(3, 3, 3, 3));
+    carry = _mm_unpackhi_epi64(carry, carry);
+  }
+  if (i > 0)
+    value = out[i-1];
+#endif
 
-  // Return
-  return (ret == Z_STREAM_END);
+  const uchar* ptr = (const uchar*) dataPtr;
+  for (; i < count; ++i)
+  {
+    quint16 encoded = ptr[i*2] | (ptr[i*2+1] << 8);
+    value += (encoded >> 1) ^ (-(encoded & 1));
+    out[i] = value;
+  }
+  return dataPtr + count*2;
 }
 
-
-const char* read_zigzag_encoded_int16_array(const char* dataPtr, int count, qint16* out)
+//! Decodes "high watermark" encoded indices (with 16-bit or 32-bit indices)
+template<typename T>
+static const char* read_high_watermark_encoded_indices(const char* dataPtr, int count, T* out)
 {
+  const T* srcIdxPtr = (const T*) dataPtr;
+  T highest = 0;
   for (int i = 0; i < count; ++i)
   {
-    quint16 encoded = *(quint16*) dataPtr;
-    dataPtr += 2;
-    qint16 decoded = (encoded >> 1) ^ (-(encoded & 1));
-    *out++ = decoded;
+    T code = srcIdxPtr[i];
+    out[i] = highest - code;
+    if (code == 0)
+      ++highest;
   }
-  return dataPtr;
+  return dataPtr + count*sizeof(T);
 }
 
 
-static QString _tileFilename(int tx, int ty, int tz)
+#include "tilearchive.h"
+
+//! Archive of downloaded tiles. It is destroyed at exit, which gives back the space reserved for appending
+class QuantizedMeshTileArchive : public TileArchive
+{
+public:
+  QuantizedMeshTileArchive()
+    : TileArchive("/tmp/terrain.pack")
+  {
+    // tiles used to be stored as individual files - move them to the archive
+    if (count() == 0)
+      importDirectory("/tmp", "terrain");
+  }
+};
+
+Q_GLOBAL_STATIC(QuantizedMeshTileArchive, _tileArchive)
+
+TileArchive* QuantizedMeshGeometry::tileArchive()
 {
-  return QString("/tmp/terrain-%1-%2-%3").arg(tz).arg(tx).arg(ty);
+  return _tileArchive();
 }
 
 QuantizedMeshTile* QuantizedMeshGeometry::readTile(int tx, int ty, int tz, const QgsRectangle& extent)
 {
-  QString filename = _tileFilename(tx, ty, tz);
-  QFile f(filename);
-  if (!f.open(QIODevice::ReadOnly))
+  // decompressed straight from the archive's mapping
+  TileData compressedData = tileArchive()->tileData(tx, ty, tz);
+  if (compressedData.data.isEmpty())
     return nullptr;
 
   QByteArray data;
-  if (!gzipDecompress(f.readAll(), data))
+  if (!gzipDecompress(compressedData.data, data))
     return nullptr;
 
-  if (data.isEmpty())
+  if (data.count() < (int)sizeof(QuantizedMeshHeader) + 4)
     return nullptr;
 
   QuantizedMeshTile* t = new QuantizedMeshTile;
   t->extent = extent;
 
   const char* dataPtr = data.constData();
+  const char* dataEnd = dataPtr + data.count();
   memcpy(&t->header, dataPtr, sizeof(QuantizedMeshHeader));
   dataPtr += sizeof(QuantizedMeshHeader);
 
@@ -158,47 +217,50 @@ QuantizedMeshTile* QuantizedMeshGeometry::readTile(int tx, int ty, int tz, const
 
   quint32 vertexCount = *(quint32*) dataPtr;
   dataPtr += 4;
-  t->uvh.resize(3*vertexCount);
-  qint16* vptr = t->uvh.data();
-  dataPtr = read_zigzag_encoded_int16_array(dataPtr, vertexCount*3, vptr);
-  // the individual values are just deltas of previous values!
-  qint16 u = 0, v = 0, h = 0;
-  for (uint i = 0; i < vertexCount; ++i)
+  if (dataEnd - dataPtr < (qint64)vertexCount*3*2 + 4)
   {
-    qint16 du = vptr[i], dv = vptr[vertexCount+i], dh = vptr[vertexCount*2+i];
-    u += du;
-    v += dv;
-    h += dh;
-    vptr[i] = u;
-    vptr[vertexCount+i] = v;
-    vptr[vertexCount*2+i] = h;
+    delete t;
+    return nullptr;
   }
 
-  Q_ASSERT(vertexCount < 65537);  // supporting currently only 2-byte vertex indices
+  // the individual values are just deltas of previous values - decode them together with zig-zag
+  t->uvh.resize(3*vertexCount);
+  qint16* vptr = t->uvh.data();
+  dataPtr = read_zigzag_encoded_delta_int16_array(dataPtr, vertexCount, vptr);
+  dataPtr = read_zigzag_encoded_delta_int16_array(dataPtr, vertexCount, vptr + vertexCount);
+  dataPtr = read_zigzag_encoded_delta_int16_array(dataPtr, vertexCount, vptr + vertexCount*2);
 
-  // index data - if less than 65537 vertices (otherwise indices would be 4-byte)
-  // with "high watermark" encoding
+  // index data - with "high watermark" encoding.
+  // if there are more than 65536 vertices, indices are 4-byte and the index data
+  // are padded to be 4-byte aligned (otherwise 2-byte indices, 2-byte alignment)
 
-  //struct IndexData16
+  //struct IndexData16 / IndexData32
   //{
   //  unsigned int triangleCount;
-  //  unsigned short indices[triangleCount * 3];
+  //  unsigned short/int indices[triangleCount * 3];
   //}
 
-  quint32 triangleCount = *(quint32*) dataPtr;
+  t->indices32bit = vertexCount > 65536;
+  int indexSize = t->indices32bit ? 4 : 2;
+  int offset = dataPtr - data.constData();
+  if (offset % indexSize)
+    dataPtr += indexSize - offset % indexSize;
+
+  quint32 triangleCount = dataEnd - dataPtr >= 4 ? *(quint32*) dataPtr : 0;
   dataPtr += 4;
-  t->indices.resize(3*triangleCount);
-  quint16* indicesPtr = t->indices.data();
-  quint16* srcIdxPtr = (quint16*)dataPtr;
-  int highest = 0;
-  for (uint i = 0; i < triangleCount*3; ++i)
+  if (dataEnd - dataPtr < (qint64)triangleCount*3*indexSize)
   {
-    quint16 code = *srcIdxPtr++;
-    *indicesPtr++ = highest - code;
-    if (code == 0)
-        ++highest;
+    delete t;
+    return nullptr;
   }
 
+  t->indexCount = 3*triangleCount;
+  t->indices.resize(t->indexCount*indexSize);
+  if (t->indices32bit)
+    dataPtr = read_high_watermark_encoded_indices<quint32>(dataPtr, t->indexCount, (quint32*) t->indices.data());
+  else
+    dataPtr = read_high_watermark_encoded_indices<quint16>(dataPtr, t->indexCount, (quint16*) t->indices.data());
+
   // TODO: edge indices
 
   // TODO: extensions
@@ -211,53 +273,16 @@ QuantizedMeshTile* QuantizedMeshGeometry::readTile(int tx, int ty, int tz, const
 }
 
 
-#include <QGuiApplication>
-#include <QNetworkRequest>
-#include <QNetworkReply>
-#include "qgsnetworkaccessmanager.h"
-
-void QuantizedMeshGeometry::downloadTileIfMissing(int tx, int ty, int tz)
-{
-  // i am not proud of this bit of code... quick&dirty!
-
-  QString tileFilename = _tileFilename(tx, ty, tz);
-  if (!QFile::exists(tileFilename))
-  {
-    qDebug() << "downloading tile " << tx << " " << ty << " " << tz;
-    bool downloaded = false;
-    QString url = QString("http://assets.agi.com/stk-terrain/tilesets/world/tiles/%1/%2/%3.terrain").arg(tz).arg(tx).arg(ty);
-    QNetworkRequest request(url);
-    request.setRawHeader(QByteArray("Accept-Encoding"), QByteArray("gzip"));
-    request.setRawHeader(QByteArray("Accept"), QByteArray("application/vnd.quantized-mesh,application/octet-stream;q=0.9"));
-    request.setRawHeader(QByteArray("User-Agent"), QByteArray("Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Ubuntu Chromium/58.0.3029.110 Chrome/58.0.3029.110 Safari/537.36"));
-    QNetworkReply* reply = QgsNetworkAccessManager::instance()->get(request);
-    connect(reply, &QNetworkReply::finished, [reply, tileFilename, &downloaded] {
-        QFile fOut(tileFilename);
-        fOut.open(QIODevice::WriteOnly);
-        fOut.write(reply->readAll());
-        fOut.close();
-        reply->deleteLater();
-        downloaded = true;
-      });
-
-    while (!downloaded)
-    {
-      qApp->processEvents();
-    }
-  }
-}
-
 // --------------
 
 #include "qgscoordinatetransform.h"
 #include "qgsmaptopixel.h"
 #include "map3d.h"
 
-QuantizedMeshGeometry::QuantizedMeshGeometry(QuantizedMeshTile* t, const Map3D& map, const QgsMapToPixel& mapToPixel, const QgsCoordinateTransform& terrainToMap, QNode *parent)
-  : QGeometry(parent)
+QuantizedMeshBuffers QuantizedMeshGeometry::prepareBuffers(const QuantizedMeshTile* t, const Map3D& map, const QgsMapToPixel& mapToPixel, const QgsCoordinateTransform& terrainToMap)
 {
   int vertexCount = t->uvh.count() / 3;
-  int indexCount = t->indices.count();
+  int indexCount = t->indexCount;
 
   int vertexEntrySize = sizeof(float) * (3 + 2);
 
@@ -267,54 +292,67 @@ QuantizedMeshGeometry::QuantizedMeshGeometry(QuantizedMeshTile* t, const Map3D&
   double heightWgs = t->extent.height();
   QgsPointXY ptMinProjected = QgsPointXY(map.originX, map.originY);
 
-  QByteArray vb;
   const qint16* uvh = t->uvh.constData();
+
+  // transform all vertices from terrain's CRS to map's CRS in one go
+  // (going through PROJ point by point is very slow)
+  QVector<double> xs(vertexCount), ys(vertexCount), zs(vertexCount);
+  double* xptr = xs.data();
+  double* yptr = ys.data();
+  for (int i = 0; i < vertexCount; ++i)
+  {
+    *xptr++ = xMinWgs + widthWgs * (uvh[i] / 32767.);              // u: 0...1
+    *yptr++ = yMinWgs + heightWgs * (uvh[vertexCount+i] / 32767.);  // v: 0...1
+  }
+  if (!terrainToMap.isShortCircuited())  // nothing to do if terrain and map CRS are the same
+    terrainToMap.transformInPlace(xs, ys, zs);
+
+  QByteArray vb;
   vb.resize(vertexCount*vertexEntrySize);
   float* vbptr = (float*) vb.data();
+  const double* xProjected = xs.constData();
+  const double* yProjected = ys.constData();
+  float hMin = t->header.MinimumHeight;
+  float hRange = t->header.MaximumHeight - t->header.MinimumHeight;
   for (int i = 0; i < vertexCount; ++i)
   {
-    qint16 u = uvh[i], v = uvh[vertexCount+i], h = uvh[vertexCount*2+i];
-    float uNorm = u / 32767.f;  // 0...1
-    float vNorm = v / 32767.f;  // 0...1
-    float hNorm = h / 32767.f;  // 0...1
-    float xWgs = xMinWgs + widthWgs * uNorm;
-    float yWgs = yMinWgs + heightWgs * vNorm;
-    float hWgs = t->header.MinimumHeight + hNorm * (t->header.MaximumHeight - t->header.MinimumHeight);
+    float hNorm = uvh[vertexCount*2+i] / 32767.f;  // 0...1
+    float hWgs = hMin + hNorm * hRange;
 
-    QgsPointXY ptProjected = terrainToMap.transform(xWgs, yWgs);
-    QgsPointXY ptFinal(ptProjected.x() - ptMinProjected.x(), ptProjected.y() - ptMinProjected.y());
+    double x = xProjected[i], y = yProjected[i];
 
     // our plane is (x,-z) with y growing towards camera
-    *vbptr++ = ptFinal.x();
+    *vbptr++ = x - ptMinProjected.x();
     *vbptr++ = hWgs;
-    *vbptr++ = -ptFinal.y();
+    *vbptr++ = -(y - ptMinProjected.y());
 
-    QgsPointXY uv = mapToPixel.transform( ptProjected ) / map.tileTextureSize;
+    mapToPixel.transformInPlace(x, y);
     // texture coords
-    *vbptr++ = uv.x();
-    *vbptr++ = uv.y();
+    *vbptr++ = x / map.tileTextureSize;
+    *vbptr++ = y / map.tileTextureSize;
   }
 
-  QByteArray ib;
-  ib.resize(indexCount*2);
-  memcpy(ib.data(), t->indices.constData(), ib.count());
-  /*
-  quint16* ibptr = (quint16*)ib.data();
-  const quint16* srcptr = t->indices.constData();
-  // reverse order of indices to triangles
-  for (int i = 0; i < indexCount/3; ++i)
-  {
-    ibptr[i*3] = srcptr[i*3+2];
-    ibptr[i*3+1] = srcptr[i*3+1];
-    ibptr[i*3+2] = srcptr[i*3];
-  }
-  */
+  QuantizedMeshBuffers buffers;
+  buffers.vertexData = vb;
+  buffers.indexData = t->indices;  // already in the final form (implicitly shared)
+  buffers.indices32bit = t->indices32bit;
+  buffers.vertexCount = vertexCount;
+  buffers.indexCount = indexCount;
+  return buffers;
+}
+
+QuantizedMeshGeometry::QuantizedMeshGeometry(const QuantizedMeshBuffers& buffers, QNode *parent)
+  : QGeometry(parent)
+{
+  int vertexCount = buffers.vertexCount;
+  int indexCount = buffers.indexCount;
+  int vertexEntrySize = sizeof(float) * (3 + 2);
 
   m_vertexBuffer = new Qt3DRender::QBuffer(Qt3DRender::QBuffer::VertexBuffer, this);
-  m_vertexBuffer->setData(vb);
+  m_vertexBuffer->setData(buffers.vertexData);
 
   m_indexBuffer = new Qt3DRender::QBuffer(Qt3DRender::QBuffer::IndexBuffer, this);
-  m_indexBuffer->setData(ib);
+  m_indexBuffer->setData(buffers.indexData);
 
   m_positionAttribute = new Qt3DRender::QAttribute(this);
   m_positionAttribute->setName(Qt3DRender::QAttribute::defaultPositionAttributeName());
@@ -348,9 +386,9 @@ QuantizedMeshGeometry::QuantizedMeshGeometry(QuantizedMeshTile* t, const Map3D&
   m_indexAttribute = new Qt3DRender::QAttribute(this);
   m_indexAttribute->setAttributeType(Qt3DRender::QAttribute::IndexAttribute);
 #if QT_VERSION >= 0x050800
-  m_indexAttribute->setVertexBaseType(Qt3DRender::QAttribute::UnsignedShort);
+  m_indexAttribute->setVertexBaseType(buffers.indices32bit ? Qt3DRender::QAttribute::UnsignedInt : Qt3DRender::QAttribute::UnsignedShort);
 #else
-  m_indexAttribute->setDataType(Qt3DRender::QAttribute::UnsignedShort);
+  m_indexAttribute->setDataType(buffers.indices32bit ? Qt3DRender::QAttribute::UnsignedInt : Qt3DRender::QAttribute::UnsignedShort);
 #endif
   m_indexAttribute->setBuffer(m_indexBuffer);
   m_indexAttribute->setCount(indexCount);
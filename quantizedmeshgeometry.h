@@ -46,21 +46,41 @@ struct QuantizedMeshTile
   QgsRectangle extent;  // extent in WGS coordinates
   QuantizedMeshHeader header;
   QVector<qint16> uvh; // each coordinate 0-32767. u=lon, v=lat (within tile). not interleaved: first u, then v, then h
-  QVector<quint16> indices;  // indices of triangles (length = 3*triangle count)
+  QByteArray indices;  // indices of triangles (3*triangle count), 16-bit or 32-bit (if there are more than 65536 vertices)
+  bool indices32bit = false;
+  int indexCount = 0;
 };
 
 class QgsCoordinateTransform;
 class QgsMapToPixel;
 
 class Map3D;
+class TileArchive;
+
+//! Vertex and index data of a tile in the final form for Qt3D buffers.
+//! They are prepared in loader thread so that creation of geometry in main thread is cheap
+struct QuantizedMeshBuffers
+{
+  QByteArray vertexData;  //!< interleaved vertex position (3 floats) and texture coordinates (2 floats)
+  QByteArray indexData;   //!< indices of triangles (16-bit or 32-bit)
+  bool indices32bit = false;
+  int vertexCount = 0;
+  int indexCount = 0;
+};
 
 class QuantizedMeshGeometry : public Qt3DRender::QGeometry
 {
 public:
-  QuantizedMeshGeometry(QuantizedMeshTile* t, const Map3D& map, const QgsMapToPixel& mapToPixel, const QgsCoordinateTransform& terrainToMap, QNode *parent = nullptr);
+  //! Creates geometry from buffers prepared with prepareBuffers()
+  QuantizedMeshGeometry(const QuantizedMeshBuffers& buffers, QNode *parent = nullptr);
+
+  //! Converts decoded tile to vertex/index data in map coordinates (safe to call in worker thread)
+  static QuantizedMeshBuffers prepareBuffers(const QuantizedMeshTile* t, const Map3D& map, const QgsMapToPixel& mapToPixel, const QgsCoordinateTransform& terrainToMap);
 
   static QuantizedMeshTile* readTile(int tx, int ty, int tz, const QgsRectangle& extent);
-  static void downloadTileIfMissing(int tx, int ty, int tz);
+
+  //! Returns archive where the downloaded (gzipped) tiles are stored
+  static TileArchive* tileArchive();
 
 private:
   Qt3DRender::QBuffer* m_vertexBuffer;
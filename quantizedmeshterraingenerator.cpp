@@ -4,12 +4,53 @@
 #include "quantizedmeshgeometry.h"
 #include "terrain.h"
 
+#include "qgscoordinatetransform.h"
+#include "qgsexception.h"
 #include "qgsmapsettings.h"
 
 #include <Qt3DRender/QGeometryRenderer>
 
+#include "aabb.h"
 #include "chunknode.h"
 #include "terrainchunkloader.h"
+#include "tilefetcher.h"
+
+
+//! Estimate of the max. geometric error of quantized-mesh tiles at given zoom level (in meters).
+//! This is the same heuristic that is used by Cesium when generating the meshes:
+//! level 0 error is circumference of the earth divided by number of level 0 tiles and
+//! by the number of height samples (65) in a tile, and the error is halved at each further level
+static double _levelMaximumGeometricError(int tz)
+{
+  const double earthRadius = 6378137;
+  const int levelZeroTilesX = 2;
+  const int heightmapWidth = 65;
+  double levelZeroError = earthRadius * 2 * M_PI * 0.25 / (heightmapWidth * levelZeroTilesX);
+  return levelZeroError / (1 << tz);
+}
+
+
+//! Converts Earth-centered Earth-fixed coordinates to WGS84 longitude, latitude (in degrees) and ellipsoidal height.
+//! Uses Bowring's closed form approximation which is accurate to millimeters for points near the surface
+static void _ecefToGeodetic(double x, double y, double z, double& lon, double& lat, double& h)
+{
+  const double a = 6378137.0;
+  const double f = 1 / 298.257223563;
+  const double b = a * (1 - f);
+  const double e2 = f * (2 - f);
+  const double ep2 = (a*a - b*b) / (b*b);
+
+  double p = sqrt(x*x + y*y);
+  double theta = atan2(z * a, p * b);
+  double sinTheta = sin(theta), cosTheta = cos(theta);
+  double latRad = atan2(z + ep2 * b * sinTheta*sinTheta*sinTheta, p - e2 * a * cosTheta*cosTheta*cosTheta);
+  double sinLat = sin(latRad);
+  double n = a / sqrt(1 - e2 * sinLat*sinLat);
+
+  h = p / cos(latRad) - n;
+  lon = atan2(y, x) * 180 / M_PI;
+  lat = latRad * 180 / M_PI;
+}
 
 
 class QuantizedMeshTerrainChunkLoader : public TerrainChunkLoader
@@ -18,11 +59,20 @@ public:
   QuantizedMeshTerrainChunkLoader(Terrain* terrain, ChunkNode* node)
     : TerrainChunkLoader(terrain, node)
     , qmt(nullptr)
+    , terrainToMap(terrain->map3D().terrainGenerator->crs(), terrain->map3D().crs)  // own copy to be used in worker thread
+    , hasMesh(false)
+    , error(0)
+    , sphereRadius(0)
   {
     const Map3D& map = mTerrain->map3D();
     QuantizedMeshTerrainGenerator* generator = static_cast<QuantizedMeshTerrainGenerator*>(map.terrainGenerator.get());
 
     generator->quadTreeTileToBaseTile(node->x, node->y, node->z, tx, ty, tz);
+
+    // start download right away so that tiles in the loading queue are fetched in parallel
+    tileFetcher = generator->tileFetcher();
+    tileFetcher->requestTile(tx, ty, tz);
+
     tileRect = map.terrainGenerator->terrainTilingScheme.tileToExtent(tx, ty, tz);
 
     // we need map settings here for access to mapToPixel
@@ -32,13 +82,49 @@ public:
     mapSettings.setExtent(mTerrain->terrainToMapTransform().transformBoundingBox(tileRect));
   }
 
+  ~QuantizedMeshTerrainChunkLoader()
+  {
+    delete qmt;
+  }
+
   virtual void load() override
   {
-    QuantizedMeshGeometry::downloadTileIfMissing(tx, ty, tz);
-    qmt = QuantizedMeshGeometry::readTile(tx, ty, tz, tileRect);
-    Q_ASSERT(qmt);
+    if (tileFetcher->waitForTile(tx, ty, tz, &cancelled))
+      qmt = QuantizedMeshGeometry::readTile(tx, ty, tz, tileRect);
+
+    if (cancelled.load())
+      return;  // nobody is interested in the result anymore
 
     loadTexture();
+
+    if (!qmt)
+      return;  // no data - keep the chunk empty
+
+    hasMesh = true;
+    const Map3D& map = mTerrain->map3D();
+    buffers = QuantizedMeshGeometry::prepareBuffers(qmt, map, mapSettings.mapToPixel(), terrainToMap);
+
+    QgsRectangle mapExtent = mapSettings.extent();
+    float x0 = mapExtent.xMinimum() - map.originX;
+    float y0 = mapExtent.yMinimum() - map.originY;
+    float x1 = mapExtent.xMaximum() - map.originX;
+    float y1 = mapExtent.yMaximum() - map.originY;
+    float z0 = qmt->header.MinimumHeight, z1 = qmt->header.MaximumHeight;
+    bbox = AABB(x0, z0*map.zExaggeration, -y0, x1, z1*map.zExaggeration, -y1);
+
+    // the mesh can never be further from the real surface than is the height range of the tile
+    // (that makes the error of flat tiles much smaller than the level-based estimate)
+    error = qMin(_levelMaximumGeometricError(tz), double(z1 - z0)) * map.zExaggeration;
+
+    computeBoundingSphere();
+  }
+
+  virtual void cancel() override
+  {
+    cancelled.store(1);
+    tileFetcher->cancelTile(tx, ty, tz);
+    tileFetcher->cancelWaiting();
+    TerrainChunkLoader::cancel();
   }
 
   virtual Qt3DCore::QEntity* createEntity(Qt3DCore::QEntity* parent)
@@ -48,7 +134,7 @@ public:
     // create geometry renderer
 
     Qt3DRender::QGeometryRenderer* mesh = new Qt3DRender::QGeometryRenderer;
-    mesh->setGeometry(new QuantizedMeshGeometry(qmt, mTerrain->map3D(), mapSettings.mapToPixel(), mTerrain->terrainToMapTransform(), mesh));
+    mesh->setGeometry(new QuantizedMeshGeometry(buffers, mesh));
     entity->addComponent(mesh);
 
     // create material
@@ -65,15 +151,13 @@ public:
 
     transform->setScale3D(QVector3D(1.f, map.zExaggeration, 1.f));
 
-    QgsRectangle mapExtent = mapSettings.extent();
-    float x0 = mapExtent.xMinimum() - map.originX;
-    float y0 = mapExtent.yMinimum() - map.originY;
-    float x1 = mapExtent.xMaximum() - map.originX;
-    float y1 = mapExtent.yMaximum() - map.originY;
-    float z0 = qmt->header.MinimumHeight, z1 = qmt->header.MaximumHeight;
-
-    node->setExactBbox(AABB(x0, z0*map.zExaggeration, -y0, x1, z1*map.zExaggeration, -y1));
-    //epsilon = mapExtent.width() / map.tileTextureSize;
+    if (hasMesh)
+    {
+      node->setExactBbox(bbox);
+      node->setExactError(error);
+      if (sphereRadius > 0)
+        node->setBoundingSphere(sphereCenter, sphereRadius);
+    }
 
     entity->setEnabled(false);
     entity->setParent(parent);
@@ -81,10 +165,66 @@ public:
   }
 
 protected:
+  //! converts bounding sphere from the tile's header (in ECEF) to world coordinates
+  void computeBoundingSphere()
+  {
+    const Map3D& map = mTerrain->map3D();
+    const QuantizedMeshHeader& hdr = qmt->header;
+    double lon, lat, h;
+    _ecefToGeodetic(hdr.BoundingSphereCenterX, hdr.BoundingSphereCenterY, hdr.BoundingSphereCenterZ, lon, lat, h);
+
+    // the radius is in meters - get its length in map units by transforming a point
+    // that is the radius away to the east (the scale may differ slightly in other directions
+    // with non-conformal projections, so this is only an approximation)
+    double cosLat = cos(lat * M_PI / 180);
+    if (cosLat < 1e-3)
+      return;  // too close to the poles
+    double dLon = hdr.BoundingSphereRadius / (6378137.0 * cosLat) * 180 / M_PI;
+
+    QgsPointXY center, east;
+    try
+    {
+      center = terrainToMap.transform(QgsPointXY(lon, lat));
+      east = terrainToMap.transform(QgsPointXY(lon + dLon, lat));
+    }
+    catch (QgsCsException&)
+    {
+      return;  // keep using just the bounding box
+    }
+
+    QVector3D c(center.x() - map.originX, h * map.zExaggeration, -(center.y() - map.originY));
+    float radius = center.distance(east);
+
+    // the header's sphere encloses the tile on the ellipsoid, but the tile gets flattened by the map projection
+    // (and stretched by the exaggeration), so make sure the sphere still contains all vertices in world coordinates
+    const float* vptr = reinterpret_cast<const float*>(buffers.vertexData.constData());
+    float radiusSq = radius * radius;
+    for (int i = 0; i < buffers.vertexCount; ++i, vptr += 5)
+    {
+      float dSq = (QVector3D(vptr[0], vptr[1] * map.zExaggeration, vptr[2]) - c).lengthSquared();
+      if (dSq > radiusSq)
+        radiusSq = dSq;
+    }
+
+    sphereCenter = c;
+    sphereRadius = sqrt(radiusSq);
+  }
+
   QuantizedMeshTile* qmt;
   QgsMapSettings mapSettings;
+  QgsCoordinateTransform terrainToMap;
   int tx, ty, tz;
   QgsRectangle tileRect;
+  std::shared_ptr<TileFetcher> tileFetcher;
+  QAtomicInt cancelled;   //!< set from main thread when the chunk is not needed anymore
+
+  // prepared in load()
+  bool hasMesh;
+  QuantizedMeshBuffers buffers;
+  AABB bbox;
+  float error;
+  QVector3D sphereCenter;
+  float sphereRadius;   //!< zero if the bounding sphere is not available
 };
 
 
@@ -93,11 +233,31 @@ protected:
 
 
 QuantizedMeshTerrainGenerator::QuantizedMeshTerrainGenerator()
+  : mUrlTemplate("http://assets.agi.com/stk-terrain/tilesets/world/tiles/{z}/{x}/{y}.terrain")
 {
   terrainBaseX = terrainBaseY = terrainBaseZ = 0;
   terrainTilingScheme = TilingScheme(QgsRectangle(-180,-90,0,90), QgsCoordinateReferenceSystem("EPSG:4326"));
 }
 
+QuantizedMeshTerrainGenerator::~QuantizedMeshTerrainGenerator()
+{
+}
+
+void QuantizedMeshTerrainGenerator::setUrlTemplate(const QString &url)
+{
+  mUrlTemplate = url;
+  // loaders may be using the fetcher right now - just let it use the new URL
+  if (mTileFetcher)
+    mTileFetcher->setUrlTemplate(url);
+}
+
+std::shared_ptr<TileFetcher> QuantizedMeshTerrainGenerator::tileFetcher() const
+{
+  if (!mTileFetcher)
+    mTileFetcher = std::make_shared<TileFetcher>(QuantizedMeshGeometry::tileArchive(), mUrlTemplate);
+  return mTileFetcher;
+}
+
 void QuantizedMeshTerrainGenerator::setBaseTileFromExtent(const QgsRectangle &extentInTerrainCrs)
 {
   terrainTilingScheme.extentToTile(extentInTerrainCrs, terrainBaseX, terrainBaseY, terrainBaseZ);
@@ -127,6 +287,7 @@ void QuantizedMeshTerrainGenerator::writeXml(QDomElement &elem) const
   elem.setAttribute("base-x", terrainBaseX);
   elem.setAttribute("base-y", terrainBaseY);
   elem.setAttribute("base-z", terrainBaseZ);
+  elem.setAttribute("url", mUrlTemplate);
 }
 
 void QuantizedMeshTerrainGenerator::readXml(const QDomElement &elem)
@@ -134,6 +295,8 @@ void QuantizedMeshTerrainGenerator::readXml(const QDomElement &elem)
   terrainBaseX = elem.attribute("base-x").toInt();
   terrainBaseY = elem.attribute("base-y").toInt();
   terrainBaseZ = elem.attribute("base-z").toInt();
+  if (elem.hasAttribute("url"))
+    setUrlTemplate(elem.attribute("url"));
   // TODO: update tiling scheme
 }
 
@@ -3,11 +3,15 @@
 
 #include "terraingenerator.h"
 
+#include <memory>
+
+class TileFetcher;
 
 class QuantizedMeshTerrainGenerator : public TerrainGenerator
 {
 public:
   QuantizedMeshTerrainGenerator();
+  ~QuantizedMeshTerrainGenerator();
 
   void setBaseTileFromExtent(const QgsRectangle& extentInTerrainCrs);
 
@@ -20,7 +24,19 @@ public:
 
   virtual ChunkLoader* createChunkLoader(ChunkNode* node) const override;
 
+  //! Sets URL of tiles - it may contain {x}, {y}, {z} placeholders
+  void setUrlTemplate(const QString& url);
+  QString urlTemplate() const { return mUrlTemplate; }
+
+  //! Returns object that downloads tiles from the server. Chunk loaders keep a reference
+  //! so that the fetcher stays alive while they use it
+  std::shared_ptr<TileFetcher> tileFetcher() const;
+
   int terrainBaseX, terrainBaseY, terrainBaseZ;   //!< coordinates of the base tile
+
+private:
+  QString mUrlTemplate;
+  mutable std::shared_ptr<TileFetcher> mTileFetcher;  //!< created on demand
 };
 
 
@@ -12,6 +12,7 @@
 #include "lineentity.h"
 #include "map3d.h"
 #include "pointentity.h"
+#include "polygonchunkloader.h"
 #include "polygonentity.h"
 #include "terrain.h"
 #include "terraingenerator.h"
@@ -23,6 +24,8 @@
 #include <Qt3DExtras/QPhongMaterial>
 
 
+SceneState _sceneState(CameraController* cameraController);
+
 Scene::Scene(const Map3D& map, Qt3DExtras::QForwardRenderer *defaultFrameGraph, Qt3DRender::QRenderSettings *renderSettings, Qt3DRender::QCamera *camera, const QRect& viewportRect, Qt3DCore::QNode* parent)
   : Qt3DCore::QEntity(parent)
 {
@@ -59,8 +62,19 @@ Scene::Scene(const Map3D& map, Qt3DExtras::QForwardRenderer *defaultFrameGraph,
 
   Q_FOREACH (const PolygonRenderer& pr, map.polygonRenderers)
   {
-    PolygonEntity* p = new PolygonEntity(map, pr);
-    p->setParent(this);
+    if (pr.tiled)
+    {
+      PolygonChunkedEntity* p = new PolygonChunkedEntity(map, pr);
+      p->setParent(this);
+      if (map.showBoundingBoxes)
+        p->setShowBoundingBoxes(true);
+      chunkEntities << p;
+    }
+    else
+    {
+      PolygonEntity* p = new PolygonEntity(map, pr);
+      p->setParent(this);
+    }
   }
 
   Qt3DCore::QEntity* lightEntity = new Qt3DCore::QEntity;
@@ -76,10 +90,17 @@ Scene::Scene(const Map3D& map, Qt3DExtras::QForwardRenderer *defaultFrameGraph,
   lightEntity->addComponent(lightTransform);
   lightEntity->setParent(this);
 
+  // identical shapes used by several renderers are generated just once
+  PointShapeGeometries pointShapes(this);
   Q_FOREACH (const PointRenderer& pr, map.pointRenderers)
   {
-    PointEntity* pe = new PointEntity(map, pr);
+    PointEntity* pe = new PointEntity(map, pr, pointShapes);
     pe->setParent(this);
+    if (pe->hasBillboards())
+    {
+      pe->update(_sceneState(mCameraController));
+      pointEntities << pe;
+    }
   }
 
   Q_FOREACH (const LineRenderer& lr, map.lineRenderers)
@@ -156,6 +177,9 @@ void Scene::onCameraChanged()
     if (entity->isEnabled())
       entity->update(_sceneState(mCameraController));
   }
+
+  Q_FOREACH (PointEntity* entity, pointEntities)
+    entity->update(_sceneState(mCameraController));
 }
 
 void Scene::onFrameTriggered(float dt)
@@ -23,6 +23,7 @@ class CameraController;
 class Map3D;
 class Terrain;
 class ChunkedEntity;
+class PointEntity;
 
 /**
  * Entity that encapsulates our 3D scene - contains all other entities (such as terrain) as children.
@@ -46,6 +47,7 @@ private:
   CameraController* mCameraController;
   Terrain* mTerrain;
   QList<ChunkedEntity*> chunkEntities;
+  QList<PointEntity*> pointEntities;  //!< entities that switch far instances to billboards
 };
 
 #endif // SCENE_H
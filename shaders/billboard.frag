@@ -0,0 +1,46 @@
+#version 150 core
+
+// impostor of the instanced shape: phong shading with normals of a sphere or an upright column
+// reconstructed from the position within the quad
+
+uniform vec3 ka;                            // Ambient reflectivity
+uniform vec3 kd;                            // Diffuse reflectivity
+uniform vec3 ks;                            // Specular reflectivity
+uniform float shininess;                    // Specular shininess factor
+
+uniform vec3 eyePosition;
+
+uniform int billboardType;  // 0 = sphere, 1 = column
+
+in vec3 worldPosition;
+in vec2 quadPosition;
+in vec3 billboardRight;
+in vec3 billboardUp;
+in vec3 billboardForward;
+
+out vec4 fragColor;
+
+#pragma include light.inc.frag
+
+void main()
+{
+    // normal in the quad's frame (x = right, y = up, z = towards the camera), turned to world directions
+    vec3 worldNormal;
+    if (billboardType == 0)
+    {
+        float r2 = dot(quadPosition, quadPosition);
+        if (r2 > 1.0)
+            discard;
+        worldNormal = quadPosition.x * billboardRight + quadPosition.y * billboardUp + sqrt(1.0 - r2) * billboardForward;
+    }
+    else
+    {
+        float x = clamp(quadPosition.x, -1.0, 1.0);
+        worldNormal = x * billboardRight + sqrt(1.0 - x * x) * billboardForward;
+    }
+    worldNormal = normalize(worldNormal);
+
+    vec3 diffuseColor, specularColor;
+    adsModel(worldPosition, worldNormal, eyePosition, shininess, diffuseColor, specularColor);
+    fragColor = vec4( ka + kd * diffuseColor + ks * specularColor, 1.0 );
+}
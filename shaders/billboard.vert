@@ -0,0 +1,47 @@
+#version 150 core
+
+in vec3 vertexPosition;  // corner of the quad: x, y in [-1, 1]
+in vec3 pos;
+
+out vec3 worldPosition;
+out vec2 quadPosition;
+out vec3 billboardRight;    // world directions of the quad's axes (for reconstruction of normals)
+out vec3 billboardUp;
+out vec3 billboardForward;  // towards the camera
+
+uniform mat4 viewMatrix;
+uniform mat4 modelViewProjection;
+uniform vec3 eyePosition;
+
+uniform vec3 billboardCenter;    // center of the shape relative to the instance position
+uniform vec2 billboardHalfSize;  // half of the width and height of the shape
+uniform int billboardType;       // 0 = sphere, 1 = column
+
+void main()
+{
+    vec3 center = pos + billboardCenter;
+
+    // right and up vectors of the camera in world coordinates are rows of the view matrix
+    vec3 right = vec3(viewMatrix[0][0], viewMatrix[1][0], viewMatrix[2][0]);
+    vec3 up = vec3(viewMatrix[0][1], viewMatrix[1][1], viewMatrix[2][1]);
+    vec3 forward = vec3(viewMatrix[0][2], viewMatrix[1][2], viewMatrix[2][2]);
+
+    if (billboardType == 1)
+    {
+        // columns stay upright: only rotate around the vertical axis to face the camera
+        vec3 toCamera = eyePosition - center;
+        vec3 horizontalRight = cross(vec3(0.0, 1.0, 0.0), toCamera);
+        if (dot(horizontalRight, horizontalRight) > 1e-6)   // not when looking straight down
+            right = normalize(horizontalRight);
+        up = vec3(0.0, 1.0, 0.0);
+        forward = cross(right, up);
+    }
+
+    worldPosition = center + right * vertexPosition.x * billboardHalfSize.x + up * vertexPosition.y * billboardHalfSize.y;
+    quadPosition = vertexPosition.xy;
+    billboardRight = right;
+    billboardUp = up;
+    billboardForward = forward;
+
+    gl_Position = modelViewProjection * vec4(worldPosition, 1.0);
+}
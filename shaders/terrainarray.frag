@@ -0,0 +1,15 @@
+#version 150 core
+
+// unlit texture like QTextureMaterial, but sampling a layer of a texture array
+
+uniform sampler2DArray texArray;
+uniform int texLayer;   // layer of the tile within the texture array
+
+in vec2 texCoord;
+
+out vec4 fragColor;
+
+void main()
+{
+    fragColor = texture(texArray, vec3(texCoord, float(texLayer)));
+}
@@ -1,11 +1,30 @@
 #include "terrain.h"
 
 #include "aabb.h"
+#include "chunknode.h"
 #include "map3d.h"
 #include "maptexturegenerator.h"
+#include "maptextureimage.h"
+#include "terrainchunkloader.h"
 #include "terraingenerator.h"
+#include "terraintexturearray.h"
 
 #include "qgscoordinatetransform.h"
+#include "qgsexception.h"
+#include "qgsfeaturerequest.h"
+#include "qgsvectordataprovider.h"
+#include "qgsvectorlayer.h"
+
+#include <Qt3DRender/QTexture>
+#include <QFutureWatcher>
+#include <QTimer>
+#include <QtConcurrent/QtConcurrentRun>
+#include <cmath>
+#if QT_VERSION >= 0x050900
+#include <Qt3DExtras/QTextureMaterial>
+#else
+#include <Qt3DExtras/QDiffuseMapMaterial>
+#endif
 
 
 Terrain::Terrain(int maxLevel, const Map3D& map, Qt3DCore::QNode* parent)
@@ -13,16 +32,343 @@ Terrain::Terrain(int maxLevel, const Map3D& map, Qt3DCore::QNode* parent)
                   map.terrainGenerator->rootChunkError(map),
                   map.maxTerrainError, maxLevel, map.terrainGenerator.get(), parent)
   , map(map)
+  , mLayersChangePending(false)
+  , mLayersChangedEverywhere(false)
+  , mLayersGeneration(0)
 {
   map.terrainGenerator->setTerrain(this);
 
   mTerrainToMapTransform = new QgsCoordinateTransform(map.terrainGenerator->crs(), map.crs);
 
   mMapTextureGenerator = new MapTextureGenerator(map);
+
+  mTextureArray = map.terrainTextureArrays ? new TerrainTextureArray(16, this) : nullptr;
+
+  Q_FOREACH (QgsMapLayer* layer, map.layers())
+    connectLayer(layer);
 }
 
 Terrain::~Terrain()
 {
+  // loaders use the map texture generator
+  stopLoading();
+
   delete mMapTextureGenerator;
   delete mTerrainToMapTransform;
 }
+
+void Terrain::update(const SceneState &state)
+{
+  mSceneState = state;  // chunk loaders created during the update use it to pick texture size
+
+  ChunkedEntity::update(state);
+
+  // tiles in texture arrays have their size fixed by the array page
+  if (!mTextureArray)
+    refreshTextures(state);
+}
+
+int Terrain::textureSizeForNode(ChunkNode *node, const SceneState &state) const
+{
+  const int minSize = 64, maxSize = 1024;
+
+  // same triangle similarity as with screen space error - see ChunkedEntity
+  float dist = node->bbox.distanceFromPoint(state.cameraPos);
+  float tileSize = node->bbox.xMax - node->bbox.xMin;
+  if (dist <= 0)
+    return maxSize;
+  float pixels = tileSize * state.screenSizePx / (2 * dist * tan(state.cameraFov * M_PI / (2 * 180)));
+
+  int size = minSize;
+  while (size < pixels && size < maxSize)
+    size *= 2;
+  return size;
+}
+
+//! returns texture of a tile's entity (null if there is none)
+static Qt3DRender::QAbstractTexture* _tileTexture(Qt3DCore::QEntity* entity)
+{
+  Q_FOREACH (Qt3DCore::QComponent* component, entity->components())
+  {
+#if QT_VERSION >= 0x050900
+    if (Qt3DExtras::QTextureMaterial* material = qobject_cast<Qt3DExtras::QTextureMaterial*>(component))
+      return material->texture();
+#else
+    if (Qt3DExtras::QDiffuseMapMaterial* material = qobject_cast<Qt3DExtras::QDiffuseMapMaterial*>(component))
+      return material->diffuse();
+#endif
+  }
+  return nullptr;
+}
+
+//! whether a change of layers within the extent (null = everywhere) affects texture of a tile with given extent
+static bool _isTileAffected(const QgsRectangle& tileExtent, const QgsRectangle& changedExtent)
+{
+  return changedExtent.isNull() || tileExtent.buffered(tileExtent.width() * 0.1).intersects(changedExtent);
+}
+
+QgsRectangle Terrain::tileTextureExtent(Qt3DCore::QEntity *entity) const
+{
+  Q_FOREACH (Qt3DCore::QComponent* component, entity->components())
+  {
+    if (TerrainTextureArrayMaterial* material = qobject_cast<TerrainTextureArrayMaterial*>(component))
+      return material->textureExtent();
+  }
+
+  Qt3DRender::QAbstractTexture* texture = _tileTexture(entity);
+  if (!texture || texture->width() == 0)
+    return QgsRectangle();
+
+  MapTextureImage* image = texture->textureImages().isEmpty() ? nullptr : qobject_cast<MapTextureImage*>(texture->textureImages().first());
+  return image ? image->imageExtent() : QgsRectangle();
+}
+
+void Terrain::refreshTileTexture(Qt3DCore::QEntity *entity)
+{
+  Q_FOREACH (Qt3DCore::QComponent* component, entity->components())
+  {
+    if (TerrainTextureArrayMaterial* material = qobject_cast<TerrainTextureArrayMaterial*>(component))
+    {
+      replaceArrayLayer(material);
+      return;
+    }
+  }
+
+  Qt3DRender::QAbstractTexture* texture = _tileTexture(entity);
+  if (texture && texture->width() != 0)
+    replaceTextureImage(texture, texture->width());
+}
+
+void Terrain::refreshTileTextureIfOutdated(Qt3DCore::QEntity *entity, const QgsRectangle &extent, int generation)
+{
+  if (generation == mLayersGeneration)
+    return;
+
+  // changes older than the recorded ones are not known anymore - better to re-render
+  bool outdated = mRecentLayersChanges.isEmpty() || mRecentLayersChanges.first().first > generation + 1;
+  for (int i = 0; !outdated && i < mRecentLayersChanges.count(); ++i)
+  {
+    const QPair<int, QgsRectangle>& change = mRecentLayersChanges.at(i);
+    outdated = change.first > generation && _isTileAffected(extent, change.second);
+  }
+
+  if (outdated)
+    refreshTileTexture(entity);
+}
+
+void Terrain::refreshTextures(const SceneState &state)
+{
+  // forget requests whose tiles have been unloaded in the meanwhile (the pending image gets deleted with the texture)
+  for (auto it = mPendingTextures.begin(); it != mPendingTextures.end(); )
+  {
+    if (it.value().isNull())
+      it = mPendingTextures.erase(it);
+    else
+      ++it;
+  }
+
+  Q_FOREACH (ChunkNode* node, activeNodes)
+  {
+    Qt3DRender::QAbstractTexture* texture = _tileTexture(node->entity);
+    if (!texture || texture->width() == 0 || mPendingTextures.contains(texture))
+      continue;
+
+    // only re-render when the tile has become much closer, not for every small camera move
+    int size = textureSizeForNode(node, state);
+    if (size < texture->width() * 2)
+      continue;
+
+    replaceTextureImage(texture, size);
+  }
+}
+
+void Terrain::replaceTextureImage(Qt3DRender::QAbstractTexture *texture, int size)
+{
+  QVector<Qt3DRender::QAbstractTextureImage*> images = texture->textureImages();
+  MapTextureImage* oldImage = images.isEmpty() ? nullptr : qobject_cast<MapTextureImage*>(images.first());
+  if (!oldImage)
+    return;
+
+  // a previously requested image may be already outdated
+  if (MapTextureImage* pendingImage = mPendingTextures.value(texture))
+    delete pendingImage;  // also cancels the rendering job
+
+  // the image is a child of the texture so that it gets deleted (and its rendering cancelled) with the tile
+  MapTextureImage* newImage = new MapTextureImage(mMapTextureGenerator, oldImage->imageExtent(), size, oldImage->imageDebugText(), texture);
+  mPendingTextures.insert(texture, newImage);
+
+  connect(newImage, &MapTextureImage::textureReady, this, [this, texture, newImage, size]
+  {
+    // mip levels (and compression) are prepared in background just like when the tile got loaded.
+    // The watcher is deleted together with the pending image if the tile gets unloaded in the meanwhile
+    typedef QVector<Qt3DRender::QTextureImageDataPtr> TextureData;
+    QFutureWatcher<TextureData>* fw = new QFutureWatcher<TextureData>(newImage);
+    connect(fw, &QFutureWatcher<TextureData>::finished, this, [this, texture, newImage, size, fw]
+    {
+      mPendingTextures.remove(texture);
+
+      Q_FOREACH (Qt3DRender::QAbstractTextureImage* image, texture->textureImages())
+      {
+        texture->removeTextureImage(image);
+        image->deleteLater();
+      }
+      TextureData data = fw->result();
+      for (int i = 0; i < data.count(); ++i)
+      {
+        MapTextureImage* image = new MapTextureImage(data[i], newImage->imageExtent(), newImage->imageDebugText());
+        image->setMipLevel(i);
+        texture->addTextureImage(image);
+      }
+      texture->setSize(size, size);
+
+      newImage->deleteLater();  // it was only used to get the map rendered
+    });
+    fw->setFuture(QtConcurrent::run(TerrainChunkLoader::prepareTextureData, newImage->image(), map.compressTerrainTextures));
+  });
+}
+
+void Terrain::replaceArrayLayer(TerrainTextureArrayMaterial *material)
+{
+  if (MapTextureImage* pendingImage = mPendingTextures.value(material))
+    delete pendingImage;  // also cancels the rendering job
+
+  // the layer keeps its size - it is given by the page of the texture array.
+  // The image is a child of the material so that it gets deleted (and its rendering cancelled) with the tile
+  MapTextureImage* newImage = new MapTextureImage(mMapTextureGenerator, material->textureExtent(), material->textureSize(), QString(), material);
+  mPendingTextures.insert(material, newImage);
+
+  connect(newImage, &MapTextureImage::textureReady, this, [this, material, newImage]
+  {
+    typedef QVector<Qt3DRender::QTextureImageDataPtr> TextureData;
+    QFutureWatcher<TextureData>* fw = new QFutureWatcher<TextureData>(newImage);
+    connect(fw, &QFutureWatcher<TextureData>::finished, this, [this, material, newImage, fw]
+    {
+      mPendingTextures.remove(material);
+      mTextureArray->updateMaterial(material, fw->result());
+      newImage->deleteLater();  // it was only used to get the map rendered
+    });
+    fw->setFuture(QtConcurrent::run(TerrainChunkLoader::prepareTextureData, newImage->image(), map.compressTerrainTextures));
+  });
+}
+
+void Terrain::connectLayer(QgsMapLayer *layer)
+{
+  connect(layer, &QgsMapLayer::repaintRequested, this, &Terrain::onLayerRepaintRequested);
+  connect(layer, &QgsMapLayer::dataChanged, this, &Terrain::onLayerRepaintRequested);
+
+  QgsVectorLayer* vlayer = qobject_cast<QgsVectorLayer*>(layer);
+  if (!vlayer)
+    return;
+
+  // edits of vector layers tell us exactly what has changed
+  connect(vlayer, &QgsVectorLayer::featureAdded, this, [this, vlayer](QgsFeatureId fid)
+  {
+    addChangedFeature(vlayer, fid, vlayer->getFeature(fid).geometry());
+  });
+  connect(vlayer, &QgsVectorLayer::featureDeleted, this, [this, vlayer](QgsFeatureId fid)
+  {
+    addChangedFeature(vlayer, fid, QgsGeometry());
+  });
+  connect(vlayer, &QgsVectorLayer::geometryChanged, this, [this, vlayer](QgsFeatureId fid, const QgsGeometry& geometry)
+  {
+    addChangedFeature(vlayer, fid, geometry);
+  });
+  connect(vlayer, &QgsVectorLayer::attributeValueChanged, this, [this, vlayer](QgsFeatureId fid, int, const QVariant&)
+  {
+    // the symbology may depend on attributes
+    addChangedFeature(vlayer, fid, vlayer->getFeature(fid).geometry());
+  });
+  connect(vlayer, &QgsVectorLayer::editingStopped, this, [this, vlayer]
+  {
+    // the data source has the current geometries again (after commit or rollback)
+    mEditedFeatureExtents.remove(vlayer->id());
+  });
+}
+
+void Terrain::addChangedFeature(QgsVectorLayer *layer, QgsFeatureId fid, const QgsGeometry &geometry)
+{
+  QHash<QgsFeatureId, QgsRectangle>& editedExtents = mEditedFeatureExtents[layer->id()];
+
+  // where the feature has been before: either from an earlier edit or as stored in the data source
+  QgsRectangle oldExtent;
+  if (editedExtents.contains(fid))
+    oldExtent = editedExtents.value(fid);
+  else if (fid >= 0)  // new features have negative IDs until committed
+  {
+    QgsFeature f;
+    if (layer->dataProvider()->getFeatures(QgsFeatureRequest(fid).setNoAttributes()).nextFeature(f) && f.hasGeometry())
+      oldExtent = f.geometry().boundingBox();
+  }
+
+  if (geometry.isNull())
+    editedExtents.remove(fid);
+  else
+    editedExtents[fid] = geometry.boundingBox();
+
+  if (!oldExtent.isNull())
+    addChangedExtent(layer, oldExtent);
+  if (!geometry.isNull())
+    addChangedExtent(layer, geometry.boundingBox());
+}
+
+void Terrain::addChangedExtent(QgsMapLayer *layer, const QgsRectangle &extent)
+{
+  QgsRectangle extentMapCrs;
+  try
+  {
+    extentMapCrs = QgsCoordinateTransform(layer->crs(), map.crs).transformBoundingBox(extent);
+  }
+  catch (QgsCsException&)
+  {
+    mLayersChangedEverywhere = true;
+  }
+
+  if (mChangedExtent.isNull())
+    mChangedExtent = extentMapCrs;
+  else if (!extentMapCrs.isNull())
+    mChangedExtent.combineExtentWith(extentMapCrs);
+
+  if (!mLayersChangePending)
+  {
+    mLayersChangePending = true;
+    QTimer::singleShot(0, this, &Terrain::onLayersChanged);
+  }
+}
+
+void Terrain::onLayerRepaintRequested()
+{
+  // edits of features are followed by a repaint request - in that case we already know the affected area
+  if (mChangedExtent.isNull())
+    mLayersChangedEverywhere = true;
+
+  if (!mLayersChangePending)
+  {
+    mLayersChangePending = true;
+    QTimer::singleShot(0, this, &Terrain::onLayersChanged);
+  }
+}
+
+void Terrain::onLayersChanged()
+{
+  QgsRectangle extent = mLayersChangedEverywhere ? QgsRectangle() : mChangedExtent;
+  mLayersChangePending = false;
+  mLayersChangedEverywhere = false;
+  mChangedExtent = QgsRectangle();
+
+  if (mMapTextureGenerator->invalidateTiles(extent))
+    extent = QgsRectangle();  // styles have changed - all tiles are affected
+
+  // tiles that are being loaded right now check this when they are done
+  ++mLayersGeneration;
+  mRecentLayersChanges << qMakePair(mLayersGeneration, extent);
+  while (mRecentLayersChanges.count() > 100)
+    mRecentLayersChanges.removeFirst();
+
+  // re-render textures of affected tiles in background - their current textures stay until then
+  Q_FOREACH (ChunkNode* node, loadedNodes())
+  {
+    QgsRectangle tileExtent = tileTextureExtent(node->entity);
+    if (!tileExtent.isNull() && _isTileAffected(tileExtent, extent))
+      refreshTileTexture(node->entity);
+  }
+}
@@ -3,10 +3,33 @@
 
 #include "chunkedentity.h"
 
+#include <QHash>
+#include <QPair>
+#include <QPointer>
+
+#include "qgsfeatureid.h"
+#include "qgsrectangle.h"
+
 class Map3D;
+class QgsGeometry;
+class QgsMapLayer;
+class QgsVectorLayer;
 class MapTextureGenerator;
+class MapTextureImage;
 class QgsCoordinateTransform;
 class TerrainGenerator;
+class TerrainTextureArray;
+class TerrainTextureArrayMaterial;
+
+namespace Qt3DCore
+{
+  class QNode;
+}
+
+namespace Qt3DRender
+{
+  class QAbstractTexture;
+}
 
 /**
  * Controller for terrain - decides on what terrain tiles to show based on camera position
@@ -20,15 +43,63 @@ public:
 
   ~Terrain();
 
+  virtual void update(const SceneState& state) override;
+
   const Map3D& map3D() const { return map; }
   MapTextureGenerator* mapTextureGenerator() { return mMapTextureGenerator; }
   const QgsCoordinateTransform& terrainToMapTransform() const { return *mTerrainToMapTransform; }
+  //! Returns shared texture arrays for tiles' map textures (null if not enabled in map settings)
+  TerrainTextureArray* textureArray() { return mTextureArray; }
+
+  //! Returns state of the scene of the current (or last) update. Chunk loaders are created during the update
+  const SceneState& sceneState() const { return mSceneState; }
+  //! Returns size of map texture (power of two between 64 and 1024) appropriate for the node's size on the screen
+  int textureSizeForNode(ChunkNode* node, const SceneState& state) const;
+
+  //! Returns counter of changes of map layers. Chunk loaders remember it when they start rendering a texture
+  int layersGeneration() const { return mLayersGeneration; }
+  //! Re-renders map texture of a new tile's entity in background if layers have changed within
+  //! the extent (in map CRS) since the given generation - the texture may have been rendered from stale data
+  void refreshTileTextureIfOutdated(Qt3DCore::QEntity* entity, const QgsRectangle& extent, int generation);
+
+private slots:
+  void onLayerRepaintRequested();
+  void onLayersChanged();
 
 private:
+  //! starts rendering of bigger textures for active tiles that got much closer to the camera
+  void refreshTextures(const SceneState& state);
+  //! starts rendering of a new image for the texture, the current image is kept until the new one is ready
+  void replaceTextureImage(Qt3DRender::QAbstractTexture* texture, int size);
+  //! starts rendering of new content of the tile's layer in the texture array, the current content is kept until then
+  void replaceArrayLayer(TerrainTextureArrayMaterial* material);
+  //! re-renders map texture of a tile's entity in background (the entity may use its own texture or a texture array)
+  void refreshTileTexture(Qt3DCore::QEntity* entity);
+  //! Returns map extent of the tile's texture (null if the entity has no map texture)
+  QgsRectangle tileTextureExtent(Qt3DCore::QEntity* entity) const;
+
+  void connectLayer(QgsMapLayer* layer);
+  //! records area affected by a change of a feature (both old and new position). Null geometry means the feature is gone
+  void addChangedFeature(QgsVectorLayer* layer, QgsFeatureId fid, const QgsGeometry& geometry);
+  //! records area (in layer's CRS) that needs to be re-rendered
+  void addChangedExtent(QgsMapLayer* layer, const QgsRectangle& extent);
 
   const Map3D& map;
   MapTextureGenerator* mMapTextureGenerator;
   QgsCoordinateTransform* mTerrainToMapTransform;
+  TerrainTextureArray* mTextureArray;   //!< owned as a child node
+  SceneState mSceneState;
+  //! textures (or materials of tiles in texture arrays) with a new image being rendered
+  QHash<Qt3DCore::QNode*, QPointer<MapTextureImage> > mPendingTextures;
+
+  // changes of layers waiting to be processed (many of them usually come at once)
+  bool mLayersChangePending;
+  bool mLayersChangedEverywhere;   //!< whether we do not know the affected area
+  QgsRectangle mChangedExtent;     //!< affected area in map CRS
+  QHash<QString, QHash<QgsFeatureId, QgsRectangle> > mEditedFeatureExtents;  //!< last known bboxes of edited features (for each layer ID)
+
+  int mLayersGeneration;   //!< increased with every processed change of layers
+  QList< QPair<int, QgsRectangle> > mRecentLayersChanges;   //!< generation and affected extent of recent changes (null extent = everywhere)
 };
 
 #endif // TERRAIN_H
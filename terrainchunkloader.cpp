@@ -4,11 +4,16 @@
 #include "maptextureimage.h"
 #include "maptexturegenerator.h"
 #include "map3d.h"
+#include "mipmapgenerator.h"
 #include "terrain.h"
 #include "terraingenerator.h"
+#include "terraintexturearray.h"
+#include "texturecompression.h"
 
 #include <Qt3DRender/QTexture>
 
+#include <QImage>
+
 #if QT_VERSION >= 0x050900
 #include <Qt3DExtras/QTextureMaterial>
 #else
@@ -18,9 +23,71 @@
 #include "quantizedmeshterraingenerator.h"
 
 
+//! Returns texture data with BC1 compressed image
+static Qt3DRender::QTextureImageDataPtr _compressedTextureData(const QImage& image)
+{
+  Qt3DRender::QTextureImageDataPtr data = Qt3DRender::QTextureImageDataPtr::create();
+  data->setTarget(QOpenGLTexture::Target2D);
+  data->setFormat(QOpenGLTexture::RGB_DXT1);
+  data->setWidth(image.width());
+  data->setHeight(image.height());
+  data->setDepth(1);
+  data->setLayers(1);
+  data->setFaces(1);
+  data->setMipLevels(1);
+  data->setData(compressImageBC1(image), 8, true);
+  return data;
+}
+
+//! Returns texture data with 24-bit RGB pixels (map textures are opaque, so alpha would be just a waste).
+//! Pixels are written directly to the texture data's array instead of converting the image
+//! to another QImage and then copying it with QTextureImageData::setImage()
+static Qt3DRender::QTextureImageDataPtr _opaqueTextureData(const QImage& image)
+{
+  Q_ASSERT(image.depth() == 32);
+  int width = image.width(), height = image.height();
+
+  Qt3DRender::QTextureImageDataPtr data = Qt3DRender::QTextureImageDataPtr::create();
+  if ((width * 3) % 4 != 0 && height > 1)
+  {
+    // OpenGL expects rows aligned to four bytes, which only happens with the smallest mip levels
+    data->setImage(image);
+    return data;
+  }
+
+  QByteArray bytes;
+  bytes.resize(width * height * 3);
+  uchar* out = reinterpret_cast<uchar*>(bytes.data());
+  for (int y = 0; y < height; ++y)
+  {
+    const QRgb* line = reinterpret_cast<const QRgb*>(image.constScanLine(y));
+    for (int x = 0; x < width; ++x)
+    {
+      *out++ = qRed(line[x]);
+      *out++ = qGreen(line[x]);
+      *out++ = qBlue(line[x]);
+    }
+  }
+
+  data->setTarget(QOpenGLTexture::Target2D);
+  data->setFormat(QOpenGLTexture::RGB8_UNorm);
+  data->setPixelFormat(QOpenGLTexture::RGB);
+  data->setPixelType(QOpenGLTexture::UInt8);
+  data->setWidth(width);
+  data->setHeight(height);
+  data->setDepth(1);
+  data->setLayers(1);
+  data->setFaces(1);
+  data->setMipLevels(1);
+  data->setData(bytes, 3, false);
+  return data;
+}
+
+
 TerrainChunkLoader::TerrainChunkLoader(Terrain* terrain, ChunkNode* node)
   : ChunkLoader(node)
   , mTerrain(terrain)
+  , mLayersGeneration(terrain->layersGeneration())
 {
   const Map3D& map = mTerrain->map3D();
   int tx, ty, tz;
@@ -40,19 +107,67 @@ TerrainChunkLoader::TerrainChunkLoader(Terrain* terrain, ChunkNode* node)
   QgsRectangle extentTerrainCrs = map.terrainGenerator->terrainTilingScheme.tileToExtent(tx, ty, tz);
   mExtentMapCrs = terrain->terrainToMapTransform().transformBoundingBox(extentTerrainCrs);
   mTileDebugText = map.drawTerrainTileInfo ? QString("%1 | %2 | %3").arg(tx).arg(ty).arg(tz) : QString();
+
+  // loaders are created during terrain's update, so the scene state is current
+  mTextureSize = terrain->textureSizeForNode(node, terrain->sceneState());
+
+  // start rendering right away so that textures of tiles in the loading queue get rendered in parallel
+  if (map.parallelTextureRendering)
+    mTextureRequest = mTerrain->mapTextureGenerator()->requestTile(mExtentMapCrs, mTextureSize, mTileDebugText);
+}
+
+TerrainChunkLoader::~TerrainChunkLoader()
+{
+  if (mTextureRequest)
+    mTerrain->mapTextureGenerator()->cancelTileRequest(mTextureRequest);
+}
+
+void TerrainChunkLoader::cancel()
+{
+  if (mTextureRequest)
+    mTerrain->mapTextureGenerator()->cancelTileRequest(mTextureRequest);
 }
 
 void TerrainChunkLoader::loadTexture()
 {
-  mTextureImage = mTerrain->mapTextureGenerator()->renderSynchronously(mExtentMapCrs, mTileDebugText);
+  MapTextureGenerator* mapGen = mTerrain->mapTextureGenerator();
+  QImage img = mTextureRequest ? mapGen->waitForTile(mTextureRequest) : mapGen->renderSynchronously(mExtentMapCrs, mTextureSize, mTileDebugText);
+  if (img.isNull())
+    return;  // cancelled - the chunk is not going to be used
+
+  mTextureData = prepareTextureData(img, mTerrain->map3D().compressTerrainTextures);
+}
+
+QVector<Qt3DRender::QTextureImageDataPtr> TerrainChunkLoader::prepareTextureData(const QImage &img, bool compress)
+{
+  // the whole mip chain is prepared here so that the GPU does not need to generate it
+  QVector<Qt3DRender::QTextureImageDataPtr> data;
+  Q_FOREACH (const QImage& level, generateMipmaps(img))
+    data << (compress ? _compressedTextureData(level) : _opaqueTextureData(level));
+  return data;
 }
 
 void TerrainChunkLoader::createTextureComponent(Qt3DCore::QEntity* entity)
 {
+  if (TerrainTextureArray* textureArray = mTerrain->textureArray())
+  {
+    entity->addComponent(textureArray->createMaterial(mTextureData, mExtentMapCrs));
+    mTextureData.clear();  // owned by data generators of the texture images from now on
+    mTerrain->refreshTileTextureIfOutdated(entity, mExtentMapCrs, mLayersGeneration);
+    return;
+  }
+
   Qt3DRender::QTexture2D* texture = new Qt3DRender::QTexture2D(entity);
-  MapTextureImage* image = new MapTextureImage(mTextureImage, mExtentMapCrs, mTileDebugText);
-  texture->addTextureImage(image);
-  texture->setMinificationFilter(Qt3DRender::QTexture2D::Linear);
+  for (int i = 0; i < mTextureData.count(); ++i)
+  {
+    MapTextureImage* image = new MapTextureImage(mTextureData[i], mExtentMapCrs, mTileDebugText);
+    image->setMipLevel(i);
+    texture->addTextureImage(image);
+  }
+  mTextureData.clear();  // owned by data generators of the texture images from now on
+  texture->setSize(mTextureSize, mTextureSize);  // also used to tell whether a bigger texture is needed later
+  texture->setGenerateMipMaps(false);  // we have uploaded all levels
+  texture->setMinificationFilter(Qt3DRender::QTexture2D::LinearMipMapLinear);
   texture->setMagnificationFilter(Qt3DRender::QTexture2D::Linear);
   Qt3DExtras::QTextureMaterial* material;
 #if QT_VERSION >= 0x050900
@@ -65,4 +180,7 @@ void TerrainChunkLoader::createTextureComponent(Qt3DCore::QEntity* entity)
   material->setAmbient(Qt::white);
 #endif
   entity->addComponent(material);  // takes ownership if the component has no parent
+
+  // layers may have changed while the texture was being rendered
+  mTerrain->refreshTileTextureIfOutdated(entity, mExtentMapCrs, mLayersGeneration);
 }
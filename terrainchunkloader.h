@@ -3,27 +3,45 @@
 
 #include "chunkloader.h"
 
+#include <Qt3DRender/QTextureImageData>
 #include <QImage>
+#include <QVector>
 #include "qgsrectangle.h"
 
+#include "maptexturegenerator.h"
+
 class Terrain;
 
 
+//! Base class for terrain chunk loaders. Map texture of the tile is rendered
+//! and converted to texture data in the worker thread by loadTexture()
 class TerrainChunkLoader : public ChunkLoader
 {
 public:
   TerrainChunkLoader(Terrain* terrain, ChunkNode* node);
+  ~TerrainChunkLoader();
+
+  //! Drops the texture request so that the worker thread does not keep waiting for it
+  virtual void cancel() override;
 
+  //! Renders map texture and prepares data for upload (run in worker thread)
   void loadTexture();
+  //! Adds material with prepared texture data to the entity (run in main thread)
   void createTextureComponent(Qt3DCore::QEntity* entity);
 
+  //! Returns texture data of all mip levels of a map image (BC1 compressed if requested). Can be run in any thread
+  static QVector<Qt3DRender::QTextureImageDataPtr> prepareTextureData(const QImage& img, bool compress);
+
 protected:
   Terrain* mTerrain;
 
 private:
   QgsRectangle mExtentMapCrs;
   QString mTileDebugText;
-  QImage mTextureImage;
+  int mTextureSize;   //!< picked from the tile's size on the screen when the loader got created
+  int mLayersGeneration;  //!< terrain's layers generation when the loader got created (the texture may be older)
+  MapTextureRequestPtr mTextureRequest;  //!< not null if the texture is being rendered in the thread pool
+  QVector<Qt3DRender::QTextureImageDataPtr> mTextureData;  //!< one item for each mip level
 };
 
 
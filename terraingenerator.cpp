@@ -1,7 +1,9 @@
 #include "terraingenerator.h"
 
 #include "aabb.h"
+#include "chunknode.h"
 #include "map3d.h"
+#include "terrain.h"
 
 
 AABB TerrainGenerator::rootChunkBbox(const Map3D& map) const
@@ -28,11 +30,35 @@ float TerrainGenerator::rootChunkError(const Map3D &map) const
 
 void TerrainGenerator::rootChunkHeightRange(float &hMin, float &hMax) const
 {
+  if (tileHeightRange(0, 0, 0, hMin, hMax))
+    return;
+
   // TODO: makes sense to have kind of default implementation?
   hMin = 0;
   hMax = 400;
 }
 
+bool TerrainGenerator::tileHeightRange(int x, int y, int z, float &hMin, float &hMax) const
+{
+  Q_UNUSED(x);
+  Q_UNUSED(y);
+  Q_UNUSED(z);
+  Q_UNUSED(hMin);
+  Q_UNUSED(hMax);
+  return false;
+}
+
+void TerrainGenerator::updateSkeletonBbox(ChunkNode *node) const
+{
+  float hMin, hMax;
+  if (!mTerrain || !tileHeightRange(node->x, node->y, node->z, hMin, hMax))
+    return;
+
+  const Map3D& map = mTerrain->map3D();
+  node->bbox.yMin = hMin * map.zExaggeration;
+  node->bbox.yMax = hMax * map.zExaggeration;
+}
+
 float TerrainGenerator::heightAt(double x, double y, const Map3D &map) const
 {
   Q_UNUSED(x);
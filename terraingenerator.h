@@ -50,6 +50,12 @@ public:
   //! Returns height range of the root chunk in world coordinates
   virtual void rootChunkHeightRange(float& hMin, float& hMax) const;
 
+  //! Returns height range of a tile (in terrain's units) if it is known before the tile gets loaded
+  virtual bool tileHeightRange(int x, int y, int z, float& hMin, float& hMax) const;
+
+  //! Sets vertical range of the skeleton node's bounding box from tileHeightRange() if available
+  virtual void updateSkeletonBbox(ChunkNode* node) const override;
+
   //! Returns height at (x,y) in terrain's CRS
   virtual float heightAt(double x, double y, const Map3D& map) const;
 
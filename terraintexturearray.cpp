@@ -0,0 +1,143 @@
+#include "terraintexturearray.h"
+
+#include "maptextureimage.h"
+
+#include <Qt3DRender/QEffect>
+#include <Qt3DRender/QFilterKey>
+#include <Qt3DRender/QGraphicsApiFilter>
+#include <Qt3DRender/QMaterial>
+#include <Qt3DRender/QParameter>
+#include <Qt3DRender/QRenderPass>
+#include <Qt3DRender/QShaderProgram>
+#include <Qt3DRender/QTechnique>
+#include <Qt3DRender/QTexture>
+
+#include <QUrl>
+
+
+TerrainTextureArrayMaterial::~TerrainTextureArrayMaterial()
+{
+  if (mTextureArray)  // may be gone already if the whole terrain is being destroyed
+    mTextureArray->releaseLayer(mPage, mLayer);
+}
+
+
+TerrainTextureArray::TerrainTextureArray(int layersPerPage, Qt3DCore::QNode *parent)
+  : Qt3DCore::QNode(parent)
+  , mLayersPerPage(layersPerPage)
+{
+  Qt3DRender::QFilterKey* filterKey = new Qt3DRender::QFilterKey;
+  filterKey->setName("renderingStyle");
+  filterKey->setValue("forward");
+
+  Qt3DRender::QShaderProgram* shaderProgram = new Qt3DRender::QShaderProgram;
+  shaderProgram->setVertexShaderCode(Qt3DRender::QShaderProgram::loadSource(QUrl("qrc:/shaders/terrainarray.vert")));
+  shaderProgram->setFragmentShaderCode(Qt3DRender::QShaderProgram::loadSource(QUrl("qrc:/shaders/terrainarray.frag")));
+
+  Qt3DRender::QRenderPass* renderPass = new Qt3DRender::QRenderPass;
+  renderPass->setShaderProgram(shaderProgram);
+
+  Qt3DRender::QTechnique* technique = new Qt3DRender::QTechnique;
+  technique->addFilterKey(filterKey);
+  technique->addRenderPass(renderPass);
+  technique->graphicsApiFilter()->setApi(Qt3DRender::QGraphicsApiFilter::OpenGL);
+  technique->graphicsApiFilter()->setProfile(Qt3DRender::QGraphicsApiFilter::CoreProfile);
+  technique->graphicsApiFilter()->setMajorVersion(3);
+  technique->graphicsApiFilter()->setMinorVersion(2);
+
+  mEffect = new Qt3DRender::QEffect(this);
+  mEffect->addTechnique(technique);
+}
+
+Qt3DRender::QMaterial *TerrainTextureArray::createMaterial(const QVector<Qt3DRender::QTextureImageDataPtr> &mipLevels, const QgsRectangle &extent)
+{
+  Q_ASSERT(!mipLevels.isEmpty());
+  const Qt3DRender::QTextureImageDataPtr& base = mipLevels.first();
+
+  int layer;
+  int pageIndex = allocateLayer(base->width(), base->isCompressed(), layer);
+  Page& page = mPages[pageIndex];
+
+  setLayerImages(pageIndex, layer, mipLevels, extent);
+
+  Qt3DRender::QMaterial* material = new TerrainTextureArrayMaterial(this, pageIndex, layer, base->width(), extent);
+  material->setEffect(mEffect);
+  material->addParameter(new Qt3DRender::QParameter(QStringLiteral("texArray"), page.texture));
+  material->addParameter(new Qt3DRender::QParameter(QStringLiteral("texLayer"), layer));
+  return material;
+}
+
+void TerrainTextureArray::updateMaterial(TerrainTextureArrayMaterial *material, const QVector<Qt3DRender::QTextureImageDataPtr> &mipLevels)
+{
+  Q_ASSERT(material->mTextureArray == this);
+  Q_ASSERT(!mipLevels.isEmpty() && mipLevels.first()->width() == material->mSize);
+  setLayerImages(material->mPage, material->mLayer, mipLevels, material->mExtent);
+}
+
+int TerrainTextureArray::usedLayers() const
+{
+  int count = 0;
+  Q_FOREACH (const Page& page, mPages)
+    count += mLayersPerPage - page.freeLayers.count();
+  return count;
+}
+
+int TerrainTextureArray::allocateLayer(int size, bool compressed, int &layer)
+{
+  for (int i = 0; i < mPages.count(); ++i)
+  {
+    Page& page = mPages[i];
+    if (page.size == size && page.compressed == compressed && !page.freeLayers.isEmpty())
+    {
+      layer = page.freeLayers.takeLast();
+      return i;
+    }
+  }
+
+  // all pages are full - add a new one
+  Page page;
+  page.size = size;
+  page.compressed = compressed;
+  page.texture = new Qt3DRender::QTexture2DArray(this);
+  page.texture->setSize(size, size);
+  page.texture->setLayers(mLayersPerPage);
+  page.texture->setFormat(compressed ? Qt3DRender::QAbstractTexture::RGB_DXT1 : Qt3DRender::QAbstractTexture::RGB8_UNorm);
+  page.texture->setGenerateMipMaps(false);  // tiles come with all mip levels
+  page.texture->setMinificationFilter(Qt3DRender::QAbstractTexture::LinearMipMapLinear);
+  page.texture->setMagnificationFilter(Qt3DRender::QAbstractTexture::Linear);
+  page.images.resize(mLayersPerPage);
+  for (int i = mLayersPerPage - 1; i >= 0; --i)
+    page.freeLayers << i;
+
+  layer = page.freeLayers.takeLast();
+  mPages << page;
+  return mPages.count() - 1;
+}
+
+void TerrainTextureArray::setLayerImages(int pageIndex, int layer, const QVector<Qt3DRender::QTextureImageDataPtr> &mipLevels, const QgsRectangle &extent)
+{
+  Page& page = mPages[pageIndex];
+
+  // drop images of the tile that has used the layer before (or of its older content)
+  Q_FOREACH (MapTextureImage* image, page.images[layer])
+  {
+    page.texture->removeTextureImage(image);
+    delete image;
+  }
+  page.images[layer].clear();
+
+  for (int i = 0; i < mipLevels.count(); ++i)
+  {
+    MapTextureImage* image = new MapTextureImage(mipLevels[i], extent, QString());
+    image->setLayer(layer);
+    image->setMipLevel(i);
+    page.texture->addTextureImage(image);
+    page.images[layer] << image;
+  }
+}
+
+void TerrainTextureArray::releaseLayer(int page, int layer)
+{
+  // images are kept until the layer is used again - the layer's content is not visible anyway
+  mPages[page].freeLayers << layer;
+}
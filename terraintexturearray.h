@@ -0,0 +1,98 @@
+#ifndef TERRAINTEXTUREARRAY_H
+#define TERRAINTEXTUREARRAY_H
+
+#include <Qt3DCore/QNode>
+#include <Qt3DRender/QMaterial>
+#include <Qt3DRender/QTextureImageData>
+
+#include <QPointer>
+#include <QVector>
+
+#include "qgsrectangle.h"
+
+namespace Qt3DRender
+{
+  class QEffect;
+  class QMaterial;
+  class QTexture2DArray;
+}
+
+class MapTextureImage;
+class TerrainTextureArray;
+
+
+//! Material of a single tile - returns its layer to the texture array when deleted
+class TerrainTextureArrayMaterial : public Qt3DRender::QMaterial
+{
+  Q_OBJECT
+public:
+  TerrainTextureArrayMaterial(TerrainTextureArray* textureArray, int page, int layer, int size, const QgsRectangle& extent)
+    : mTextureArray(textureArray), mPage(page), mLayer(layer), mSize(size), mExtent(extent) {}
+  ~TerrainTextureArrayMaterial();
+
+  //! Returns width and height of the tile's layer
+  int textureSize() const { return mSize; }
+  //! Returns map extent of the tile's texture
+  QgsRectangle textureExtent() const { return mExtent; }
+
+private:
+  friend class TerrainTextureArray;
+
+  QPointer<TerrainTextureArray> mTextureArray;
+  int mPage, mLayer;
+  int mSize;
+  QgsRectangle mExtent;
+};
+
+
+/**
+ * Keeps map textures of terrain tiles as layers of shared 2D texture arrays ("pages"),
+ * so that all tiles use the same shader program and only differ in the page and layer.
+ * Layers are allocated when a tile's material is created and returned for reuse when
+ * the material gets deleted (together with the tile's entity).
+ *
+ * Qt3D uploads a whole texture when any of its images changes, so pages are kept relatively
+ * small to limit the cost of (re)using a layer.
+ *
+ * To be used from the main thread only.
+ */
+class TerrainTextureArray : public Qt3DCore::QNode
+{
+  Q_OBJECT
+public:
+  TerrainTextureArray(int layersPerPage = 16, Qt3DCore::QNode* parent = nullptr);
+
+  //! Returns material for a tile with given texture data (one item per mip level) placed in a free layer.
+  //! All tiles need to be square
+  Qt3DRender::QMaterial* createMaterial(const QVector<Qt3DRender::QTextureImageDataPtr>& mipLevels, const QgsRectangle& extent);
+
+  //! Replaces content of the material's layer with new texture data (e.g. after the map has changed).
+  //! The data need to have the same size and format as the data the material has been created with
+  void updateMaterial(TerrainTextureArrayMaterial* material, const QVector<Qt3DRender::QTextureImageDataPtr>& mipLevels);
+
+  //! Returns number of layers currently used by tiles
+  int usedLayers() const;
+
+private:
+  struct Page
+  {
+    Qt3DRender::QTexture2DArray* texture;
+    int size;          //!< width and height of layers
+    bool compressed;   //!< whether layers use BC1 compression
+    QVector<int> freeLayers;
+    QVector< QVector<MapTextureImage*> > images;   //!< for each layer images of individual mip levels
+  };
+
+  int allocateLayer(int size, bool compressed, int& layer);
+  void releaseLayer(int page, int layer);
+  //! replaces images of a layer by images with the texture data
+  void setLayerImages(int page, int layer, const QVector<Qt3DRender::QTextureImageDataPtr>& mipLevels, const QgsRectangle& extent);
+
+  friend class TerrainTextureArrayMaterial;
+
+  int mLayersPerPage;
+  Qt3DRender::QEffect* mEffect;   //!< shared by materials of all tiles
+  QVector<Page> mPages;
+};
+
+#endif // TERRAINTEXTUREARRAY_H
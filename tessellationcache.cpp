@@ -0,0 +1,240 @@
+#include "tessellationcache.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QDomDocument>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include "qgsabstractgeometry.h"
+#include "qgsgeometry.h"
+#include "qgsrasterlayer.h"
+#include "qgsvectorlayer.h"
+
+#include "demterraingenerator.h"
+#include "map3d.h"
+#include "terraingenerator.h"
+
+
+static const quint32 CACHE_MAGIC = 0x54455353;  // "TESS"
+static const quint32 CACHE_VERSION = 1;          // increase when the tessellation output changes
+
+static const int MAX_UNUSED_DAYS = 30;                        // cache files not used for this long get removed
+static const qint64 MAX_DIRECTORY_SIZE = 512 * 1024 * 1024;   // above this size the least recently used files get removed
+
+
+static QString _hash(const QByteArray& data)
+{
+  return QString::fromLatin1(QCryptographicHash::hash(data, QCryptographicHash::Sha1).toHex());
+}
+
+//! common parts of renderer keys: layer, world and how z values are calculated
+static QString _baseRendererKey(const Map3D& map, QgsVectorLayer* layer, AltitudeClamping altClamping, AltitudeBinding altBinding, float height, float extrusionHeight)
+{
+  QString str = QString("%1|%2|%3|%4|%5 %6|%7|%8 %9|%10 %11")
+      .arg(CACHE_VERSION)
+      .arg(layer->providerType(), layer->source())
+      .arg(map.crs.toWkt())
+      .arg(map.originX, 0, 'g', 17).arg(map.originY, 0, 'g', 17)
+      .arg(map.zExaggeration, 0, 'g', 17)
+      .arg(altClampingToString(altClamping), altBindingToString(altBinding))
+      .arg(height, 0, 'g', 9).arg(extrusionHeight, 0, 'g', 9);
+
+  // heights of the terrain are only used when clamping to the terrain
+  if (altClamping != AltClampAbsolute)
+  {
+    QDomDocument doc;
+    QDomElement elem = doc.createElement("generator");
+    map.terrainGenerator->writeXml(elem);
+    doc.appendChild(elem);
+    str += '|' + doc.toString();
+
+    // the generator's XML only references the DEM layer - the data may change under the same layer
+    if (map.terrainGenerator->type() == TerrainGenerator::Dem)
+    {
+      if (QgsRasterLayer* dem = static_cast<DemTerrainGenerator*>(map.terrainGenerator.get())->layer())
+      {
+        str += '|' + dem->source();
+        QFileInfo fi(dem->source().section('|', 0, 0));  // if it is a file, strip any extra options
+        if (fi.isFile())
+          str += QString("|%1 %2").arg(fi.lastModified().toMSecsSinceEpoch()).arg(fi.size());
+      }
+    }
+  }
+  return str;
+}
+
+//! Removes cache files that have not been used for a long time (their keys may never come again,
+//! e.g. because the data have changed) and the least recently used ones if the directory is too big
+static void _pruneDirectory(const QString& directory, const QString& keepFileName)
+{
+  QDateTime oldest = QDateTime::currentDateTime().addDays(-MAX_UNUSED_DAYS);
+  qint64 totalSize = 0;
+  // newest first
+  Q_FOREACH (const QFileInfo& fi, QDir(directory).entryInfoList(QStringList("*.bin"), QDir::Files, QDir::Time))
+  {
+    if (fi.fileName() != keepFileName && (fi.lastModified() < oldest || totalSize + fi.size() > MAX_DIRECTORY_SIZE))
+      QFile::remove(fi.filePath());
+    else
+      totalSize += fi.size();
+  }
+}
+
+
+TessellationCache::TessellationCache(const QString &directory, const QString &key)
+  : mChanged(false)
+{
+  QDir().mkpath(directory);
+  mPath = QString("%1/%2.bin").arg(directory, key);
+  _pruneDirectory(directory, QFileInfo(mPath).fileName());
+  load();
+}
+
+QString TessellationCache::defaultDirectory()
+{
+  return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/tessellation";
+}
+
+QString TessellationCache::polygonRendererKey(const Map3D &map, const PolygonRenderer &settings)
+{
+  return _hash(("polygon|" + _baseRendererKey(map, settings.layer(), settings.altClamping, settings.altBinding, settings.height, settings.extrusionHeight)).toUtf8());
+}
+
+QString TessellationCache::lineRendererKey(const Map3D &map, const LineRenderer &settings)
+{
+  QString str = "line-ribbon|" + _baseRendererKey(map, settings.layer(), settings.altClamping, settings.altBinding, settings.height, settings.extrusionHeight);
+  str += QString("|%1").arg(settings.distance, 0, 'g', 9);
+  return _hash(str.toUtf8());
+}
+
+QByteArray TessellationCache::geometryHash(const QgsGeometry &geometry)
+{
+  return QCryptographicHash::hash(geometry.constGet()->asWkb(), QCryptographicHash::Sha1);
+}
+
+bool TessellationCache::mesh(QgsFeatureId fid, const QByteArray &geometryHash, TessellatedMesh &mesh)
+{
+  auto it = mEntries.constFind(fid);
+  if (it == mEntries.constEnd() || it->geometryHash != geometryHash)
+    return false;
+
+  mesh = it->mesh;
+  mUsed.insert(fid);
+  return true;
+}
+
+void TessellationCache::addMesh(QgsFeatureId fid, const QByteArray &geometryHash, const TessellatedMesh &mesh)
+{
+  Entry entry;
+  entry.geometryHash = geometryHash;
+  entry.mesh = mesh;
+  mEntries.insert(fid, entry);
+  mUsed.insert(fid);
+  mChanged = true;
+}
+
+
+template<typename T>
+static void _writeVector(QDataStream& stream, const QVector<T>& vec)
+{
+  stream << qint32(vec.count());
+  stream.writeRawData(reinterpret_cast<const char*>(vec.constData()), vec.count() * sizeof(T));
+}
+
+template<typename T>
+static bool _readVector(QDataStream& stream, QVector<T>& vec)
+{
+  qint32 count;
+  stream >> count;
+  if (stream.status() != QDataStream::Ok || count < 0 || stream.device()->bytesAvailable() < qint64(count) * qint64(sizeof(T)))
+    return false;
+  vec.resize(count);
+  return stream.readRawData(reinterpret_cast<char*>(vec.data()), count * sizeof(T)) == int(count * sizeof(T));
+}
+
+
+bool TessellationCache::save()
+{
+  // features that were not requested this time do not exist anymore
+  if (mUsed.count() != mEntries.count())
+  {
+    for (auto it = mEntries.begin(); it != mEntries.end(); )
+    {
+      if (!mUsed.contains(it.key()))
+        it = mEntries.erase(it);
+      else
+        ++it;
+    }
+    mChanged = true;
+  }
+
+  if (!mChanged)
+  {
+#if QT_VERSION >= 0x050A00
+    // keep the modification time as time of last use, so that the file does not get pruned
+    QFile file(mPath);
+    if (file.open(QIODevice::ReadWrite))
+      file.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+#endif
+    return true;
+  }
+
+  // mesh data are written in native byte order - the cache is not meant to be portable
+  QSaveFile file(mPath);
+  if (!file.open(QIODevice::WriteOnly))
+  {
+    qDebug() << "failed to write tessellation cache" << mPath;
+    return false;
+  }
+
+  QDataStream stream(&file);
+  stream << CACHE_MAGIC << CACHE_VERSION << qint32(mEntries.count());
+  for (auto it = mEntries.constBegin(); it != mEntries.constEnd(); ++it)
+  {
+    stream << qint64(it.key()) << it->geometryHash;
+    _writeVector(stream, it->mesh.data);
+    _writeVector(stream, it->mesh.indices);
+  }
+
+  if (stream.status() != QDataStream::Ok || !file.commit())
+  {
+    qDebug() << "failed to write tessellation cache" << mPath;
+    return false;
+  }
+  mChanged = false;
+  return true;
+}
+
+void TessellationCache::load()
+{
+  QFile file(mPath);
+  if (!file.open(QIODevice::ReadOnly))
+    return;  // nothing cached yet
+
+  QDataStream stream(&file);
+  quint32 magic, version;
+  qint32 count;
+  stream >> magic >> version >> count;
+  if (magic != CACHE_MAGIC || version != CACHE_VERSION || count < 0)
+    return;
+
+  mEntries.reserve(count);
+  for (int i = 0; i < count; ++i)
+  {
+    qint64 fid;
+    Entry entry;
+    stream >> fid >> entry.geometryHash;
+    if (!_readVector(stream, entry.mesh.data) || !_readVector(stream, entry.mesh.indices))
+    {
+      qDebug() << "corrupted tessellation cache" << mPath;
+      mEntries.clear();
+      return;
+    }
+    mEntries.insert(fid, entry);
+  }
+}
@@ -0,0 +1,70 @@
+#ifndef TESSELLATIONCACHE_H
+#define TESSELLATIONCACHE_H
+
+#include <QHash>
+#include <QSet>
+
+#include "qgsfeatureid.h"
+
+#include "tessellator.h"
+
+class Map3D;
+class LineRenderer;
+class PolygonRenderer;
+
+class QgsGeometry;
+class QgsVectorLayer;
+
+/**
+ * On-disk cache of tessellated features, so that features that have not changed since the last time
+ * do not need to be clamped and triangulated again when a scene is built.
+ *
+ * There is one file for each layer + renderer configuration (see polygonRendererKey() and lineRendererKey()).
+ * The whole file is loaded when the cache gets created, meshes of features are looked up by feature ID
+ * and checked against hash of the feature's geometry. When saved, only meshes of the features that
+ * have been looked up or added are kept, so deleted features do not stay in the cache forever.
+ * Files of keys that have not been used for a long time are removed when a cache gets opened.
+ */
+class TessellationCache
+{
+public:
+  //! Opens cache for the given key in the given directory (and prunes old files of other keys there)
+  TessellationCache(const QString& directory, const QString& key);
+
+  //! Default directory for the cache files
+  static QString defaultDirectory();
+
+  //! Key of the configuration of polygon renderer (layer source, CRS, origin, clamping, heights, terrain)
+  static QString polygonRendererKey(const Map3D& map, const PolygonRenderer& settings);
+
+  //! Key of the configuration of line renderer (layer source, CRS, origin, clamping, heights, terrain, buffer)
+  static QString lineRendererKey(const Map3D& map, const LineRenderer& settings);
+
+  //! Returns hash of the feature's geometry to detect changes of features
+  static QByteArray geometryHash(const QgsGeometry& geometry);
+
+  //! Looks up mesh of a feature. Returns false if it is not cached or its geometry has changed
+  bool mesh(QgsFeatureId fid, const QByteArray& geometryHash, TessellatedMesh& mesh);
+
+  //! Adds mesh of a feature with the given geometry hash
+  void addMesh(QgsFeatureId fid, const QByteArray& geometryHash, const TessellatedMesh& mesh);
+
+  //! Writes the cache file if anything has changed (otherwise just marks it as recently used)
+  bool save();
+
+private:
+  struct Entry
+  {
+    QByteArray geometryHash;
+    TessellatedMesh mesh;
+  };
+
+  void load();
+
+  QString mPath;
+  QHash<QgsFeatureId, Entry> mEntries;
+  QSet<QgsFeatureId> mUsed;  //!< features that have been looked up or added
+  bool mChanged;
+};
+
+#endif // TESSELLATIONCACHE_H
@@ -1,45 +1,66 @@
 #include "tessellator.h"
 
 #include "qgscurve.h"
+#include "qgslinestring.h"
 #include "qgspoint.h"
 #include "qgspolygon.h"
 
 #include "poly2tri/poly2tri.h"
 
+#include <QThreadStorage>
 #include <QtDebug>
 
+#include <QVector2D>
 #include <QVector3D>
 
-static void make_quad(float x0, float y0, float x1, float y1, float zLow, float zHigh, QVector<float>& data, bool addNormals)
+#include <vector>
+
+
+//! Triangulation state that is kept between polygons, so that once it is warmed up,
+//! tessellation of further polygons does not need to allocate memory
+struct TessellatorArena
 {
-  float dx = x1-x0;
-  float dy = -(y1-y0);
+  p2t::CDT cdt;
+  std::vector<p2t::Point> points;   //!< points of all rings of the current polygon
+  std::vector<float> z;             //!< z coordinates of points (same indices as in "points")
+  std::vector<p2t::Point*> polyline;
+  std::vector<p2t::Point*> holePolyline;
+  std::vector<int> ring;            //!< vertices not clipped yet by the ear clipping
+};
 
-  // perpendicular vector in plane to [x,y] is [-y,x]
-  QVector3D vn(-dy, 0, dx);
-  vn.normalize();
+//! Tessellators are usually short-lived (one per geometry or chunk), so the arena is kept for the whole
+//! life of the thread. It is only used within a single call of addPolygon() / addLineString()
+static TessellatorArena* _threadArena()
+{
+  static QThreadStorage<TessellatorArena*> arenas;
+  if (!arenas.hasLocalData())
+    arenas.setLocalData(new TessellatorArena);  // deleted when the thread exits
+  return arenas.localData();
+}
 
-  // triangle 1
-  data << x0 << zHigh << -y0;
-  if (addNormals)
-    data << vn.x() << vn.y() << vn.z();
-  data << x1 << zHigh << -y1;
-  if (addNormals)
-    data << vn.x() << vn.y() << vn.z();
-  data << x0 << zLow  << -y0;
-  if (addNormals)
-    data << vn.x() << vn.y() << vn.z();
+//! rings with at most this number of points (and without holes) are triangulated without poly2tri
+static const int MAX_EAR_CLIPPING_POINTS = 32;
 
-  // triangle 2
-  data << x0 << zLow  << -y0;
-  if (addNormals)
-    data << vn.x() << vn.y() << vn.z();
-  data << x1 << zHigh << -y1;
-  if (addNormals)
-    data << vn.x() << vn.y() << vn.z();
-  data << x1 << zLow  << -y1;
+//! miters of line joins are at most this many times longer than half of the line's width,
+//! sharper joins get beveled (otherwise sharp turns would create long spikes)
+static const float MAX_MITER_RATIO = 4;
+
+//! makes sure there is room for more items while keeping the geometric growth of the vector
+template<typename T>
+static void _reserveMore(QVector<T>& vec, int count)
+{
+  if (vec.capacity() < vec.count() + count)
+    vec.reserve(qMax(vec.count() + count, vec.capacity() * 2));
+}
+
+//! appends a vertex (with normal if enabled) and returns its index
+static inline quint32 _addVertex(QVector<float>& data, bool addNormals, float x, float y, float z, const QVector3D& normal)
+{
+  quint32 index = data.count() / (addNormals ? 6 : 3);
+  data << x << y << z;
   if (addNormals)
-    data << vn.x() << vn.y() << vn.z();
+    data << normal.x() << normal.y() << normal.z();
+  return index;
 }
 
 
@@ -47,6 +68,7 @@ Tessellator::Tessellator(double originX, double originY, bool addNormals)
   : originX(originX)
   , originY(originY)
   , addNormals(addNormals)
+  , arena(_threadArena())
 {
   stride = 3*sizeof(float);
   if (addNormals)
@@ -54,118 +76,396 @@ Tessellator::Tessellator(double originX, double originY, bool addNormals)
 }
 
 
-static bool _isRingCounterClockWise(const QgsCurve& ring)
+static bool _isRingCounterClockWise(const p2t::Point* points, int count)
 {
   double a = 0;
-  int count = ring.numPoints();
-  QgsVertexId::VertexType vt;
-  QgsPoint pt, ptPrev;
-  ring.pointAt(0, ptPrev, vt);
-  for (int i = 1; i < count + 1; ++i)
+  for (int i = 0; i < count; ++i)
   {
-    ring.pointAt(i % count, pt, vt);
-    a += ptPrev.x() * pt.y() - ptPrev.y() * pt.x();
-    ptPrev = pt;
+    const p2t::Point& pt = points[i];
+    const p2t::Point& ptNext = points[(i + 1) % count];
+    a += pt.x * ptNext.y - pt.y * ptNext.x;
   }
   return a > 0; // clockwise if a is negative
 }
 
-static void _makeWalls(const QgsCurve& ring, bool ccw, float extrusionHeight, QVector<float>& data, bool addNormals, double originX, double originY)
+//! adds walls along a ring whose points are stored in the arena at [first, first + count)
+static void _makeWalls(const TessellatorArena* arena, int first, int count, bool ccw, float extrusionHeight, QVector<float>& data, QVector<quint32>& indices, bool addNormals)
 {
+  const p2t::Point* points = arena->points.data() + first;
+  const float* z = arena->z.data() + first;
+
   // we need to find out orientation of the ring so that the triangles we generate
   // face the right direction
   // (for exterior we want clockwise order, for holes we want counter-clockwise order)
-  bool is_counter_clockwise = _isRingCounterClockWise(ring);
+  bool forward = _isRingCounterClockWise(points, count) == ccw;
+  auto ringIndex = [forward, count](int k) { return forward ? k : (count - k) % count; };
+
+  if (addNormals)
+  {
+    // each quad has its own normal, so neighbouring quads can't share vertices
+    for (int k = 0; k < count; ++k)
+    {
+      int i0 = ringIndex(k), i1 = ringIndex((k + 1) % count);
+      float x0 = points[i0].x, y0 = points[i0].y;
+      float x1 = points[i1].x, y1 = points[i1].y;
+      float dx = x1-x0;
+      float dy = -(y1-y0);
+
+      // perpendicular vector in plane to [x,y] is [-y,x]
+      QVector3D vn(-dy, 0, dx);
+      vn.normalize();
 
+      quint32 top0 = _addVertex(data, true, x0, z[i0] + extrusionHeight, -y0, vn);
+      quint32 top1 = _addVertex(data, true, x1, z[i1] + extrusionHeight, -y1, vn);
+      quint32 bottom0 = _addVertex(data, true, x0, z[i0], -y0, vn);
+      quint32 bottom1 = _addVertex(data, true, x1, z[i1], -y1, vn);
+      indices << top0 << top1 << bottom0 << bottom0 << top1 << bottom1;
+    }
+  }
+  else
+  {
+    // top and bottom vertex of each ring point are shared by the two quads next to it
+    quint32 base = data.count() / 3;
+    for (int k = 0; k < count; ++k)
+    {
+      int i = ringIndex(k);
+      data << points[i].x << z[i] + extrusionHeight << -points[i].y;
+      data << points[i].x << z[i] << -points[i].y;
+    }
+    for (int k = 0; k < count; ++k)
+    {
+      quint32 top0 = base + 2 * k, bottom0 = top0 + 1;
+      quint32 top1 = base + 2 * ((k + 1) % count), bottom1 = top1 + 1;
+      indices << top0 << top1 << bottom0 << bottom0 << top1 << bottom1;
+    }
+  }
+}
+
+//! fills the ring's points (without the closing one) to the arena starting at the given index
+static void _addRing(const QgsCurve& ring, double originX, double originY, TessellatorArena* arena, int& index)
+{
   QgsVertexId::VertexType vt;
   QgsPoint pt;
 
-  QgsPoint ptPrev;
-  ring.pointAt(is_counter_clockwise == ccw ? 0 : ring.numPoints() - 1, ptPrev, vt);
-  for (int i = 1; i < ring.numPoints(); ++i)
-  {
-    ring.pointAt(is_counter_clockwise == ccw ? i : ring.numPoints() - i - 1, pt, vt);
-    float x0 = ptPrev.x() - originX, y0 = ptPrev.y() - originY;
-    float x1 = pt.x() - originX, y1 = pt.y() - originY;
-    float height = pt.z();
-    // make a quad
-    make_quad(x0, y0, x1, y1, height, height+extrusionHeight, data, addNormals);
-    ptPrev = pt;
+  for (int i = 0; i < ring.numPoints() - 1; ++i)
+  {
+    ring.pointAt(i, pt, vt);
+    p2t::Point& pt2 = arena->points[index];
+    pt2.set(pt.x() - originX, pt.y() - originY);
+    pt2.edge_list.clear();  // keeps capacity from earlier polygons
+    arena->z[index] = qIsNaN( pt.z() ) ? 0 : pt.z();
+    ++index;
   }
 }
 
-void Tessellator::addPolygon(const QgsPolygon &polygon, float extrusionHeight)
+//! positive if a-b-c is a counter-clockwise turn, negative if clockwise, zero if collinear
+static inline double _orient(const p2t::Point& a, const p2t::Point& b, const p2t::Point& c)
 {
-  const QgsCurve* exterior = polygon.exteriorRing();
+  return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+}
 
-  QList< std::vector<p2t::Point*> > polylinesToDelete;
-  QHash<p2t::Point*, float> z;
+//! whether point p is inside or on the boundary of counter-clockwise triangle a-b-c
+static inline bool _isInTriangle(const p2t::Point& p, const p2t::Point& a, const p2t::Point& b, const p2t::Point& c)
+{
+  return _orient(a, b, p) >= 0 && _orient(b, c, p) >= 0 && _orient(c, a, p) >= 0;
+}
 
-  std::vector<p2t::Point*> polyline;
-  polyline.reserve(exterior->numPoints());
+//! whether the counter-clockwise ring is convex. Turns must not change direction and the ring
+//! must go around just once (edges change their x direction at most twice - rules out star shapes)
+static bool _isConvex(const p2t::Point* points, const std::vector<int>& ring)
+{
+  const int n = ring.size();
+  int xFlips = 0, xSign = 0;
+  for (int i = 0; i < n; ++i)
+  {
+    const p2t::Point& a = points[ring[i]];
+    const p2t::Point& b = points[ring[(i + 1) % n]];
+    const p2t::Point& c = points[ring[(i + 2) % n]];
+    if (_orient(a, b, c) < 0)
+      return false;
 
-  QgsVertexId::VertexType vt;
-  QgsPoint pt;
+    double dx = b.x - a.x;
+    int sign = dx > 0 ? 1 : (dx < 0 ? -1 : 0);
+    if (sign != 0)
+    {
+      if (xSign != 0 && sign != xSign)
+        ++xFlips;
+      xSign = sign;
+    }
+  }
+  return xFlips <= 2;
+}
 
-  for (int i = 0; i < exterior->numPoints() - 1; ++i)
+//! triangulates simple ring by clipping its ears. Returns false if there is a point where no ear
+//! can be found (e.g. the ring intersects itself) - nothing is added in that case
+static bool _earClipping(const p2t::Point* points, std::vector<int>& ring, quint32 base, QVector<quint32>& indices)
+{
+  const int indicesBefore = indices.count();
+  while (ring.size() > 3)
   {
-    exterior->pointAt(i, pt, vt);
-    p2t::Point* pt2 = new p2t::Point(pt.x() - originX, pt.y() - originY);
-    polyline.push_back(pt2);
-    float zPt = qIsNaN( pt.z() ) ? 0 : pt.z();
-    z[pt2] = zPt;
-  }
-  polylinesToDelete << polyline;
+    const int n = ring.size();
+    bool clipped = false;
+    for (int i = 0; i < n && !clipped; ++i)
+    {
+      int a = ring[(i + n - 1) % n], b = ring[i], c = ring[(i + 1) % n];
+      if (_orient(points[a], points[b], points[c]) <= 0)
+        continue;  // reflex or degenerate vertex
 
-  p2t::CDT* cdt = new p2t::CDT(polyline);
+      // no other vertex may be inside the ear
+      bool empty = true;
+      for (int j = 0; j < n && empty; ++j)
+      {
+        int p = ring[j];
+        if (p != a && p != b && p != c && _isInTriangle(points[p], points[a], points[b], points[c]))
+          empty = false;
+      }
+      if (!empty)
+        continue;
 
-  // polygon holes
-  for (int i = 0; i < polygon.numInteriorRings(); ++i)
-  {
-    std::vector<p2t::Point*> holePolyline;
-    holePolyline.reserve(exterior->numPoints());
-    const QgsCurve* hole = polygon.interiorRing(i);
-    for (int j = 0; j < hole->numPoints() - 1; ++j)
+      indices << base + a << base + b << base + c;
+      ring.erase(ring.begin() + i);
+      clipped = true;
+    }
+
+    if (!clipped)
     {
-      hole->pointAt(j, pt, vt);
-      p2t::Point* pt2 = new p2t::Point(pt.x() - originX, pt.y() - originY);
-      holePolyline.push_back(pt2);
-      float zPt = qIsNaN( pt.z() ) ? 0 : pt.z();
-      z[pt2] = zPt;
+      indices.resize(indicesBefore);
+      return false;
     }
-    cdt->AddHole(holePolyline);
-    polylinesToDelete << holePolyline;
   }
 
-  // TODO: robustness (no duplicate / nearly duplicate points, ...)
+  indices << base + ring[0] << base + ring[1] << base + ring[2];
+  return true;
+}
+
+//! fast triangulation of a ring without holes: fan for convex rings, ear clipping for other small rings.
+//! Returns false if the ring needs to go through poly2tri. Triangles are counter-clockwise like from poly2tri
+static bool _triangulateSimpleRing(TessellatorArena* arena, int count, quint32 base, QVector<quint32>& indices)
+{
+  if (count < 3 || count > MAX_EAR_CLIPPING_POINTS)
+    return false;
+
+  const p2t::Point* points = arena->points.data();
+
+  double area = 0;
+  for (int i = 0; i < count; ++i)
+  {
+    const p2t::Point& pt = points[i];
+    const p2t::Point& ptNext = points[(i + 1) % count];
+    area += pt.x * ptNext.y - pt.y * ptNext.x;
+  }
+
+  std::vector<int>& ring = arena->ring;
+  ring.resize(count);
+  for (int i = 0; i < count; ++i)
+    ring[i] = area > 0 ? i : count - 1 - i;
+
+  if (_isConvex(points, ring))
+  {
+    for (int i = 1; i < count - 1; ++i)
+      indices << base + ring[0] << base + ring[i] << base + ring[i + 1];
+    return true;
+  }
+
+  return _earClipping(points, ring, base, indices);
+}
+
+void Tessellator::addPolygon(const QgsPolygon &polygon, float extrusionHeight)
+{
+  const QgsCurve* exterior = polygon.exteriorRing();
+
+  // make room for all points first - the triangulation keeps pointers to them
+  int pointCount = exterior->numPoints() - 1;
+  for (int i = 0; i < polygon.numInteriorRings(); ++i)
+    pointCount += polygon.interiorRing(i)->numPoints() - 1;
+  if ((int)arena->points.size() < pointCount)
+    arena->points.resize(pointCount);
+  if ((int)arena->z.size() < pointCount)
+    arena->z.resize(pointCount);
+
+  int index = 0;
+  _addRing(*exterior, originX, originY, arena, index);
+  for (int i = 0; i < polygon.numInteriorRings(); ++i)
+    _addRing(*polygon.interiorRing(i), originX, originY, arena, index);
 
-  cdt->Triangulate();
+  // reserve output for roof and walls (the roof has N + 2H - 2 triangles for N points and H holes)
+  int wallCount = extrusionHeight != 0 ? pointCount : 0;
+  _reserveMore(data, int((pointCount + wallCount * (addNormals ? 4 : 2)) * stride / sizeof(float)));
+  _reserveMore(indices, 3 * (pointCount + 2 * polygon.numInteriorRings() - 2) + 6 * wallCount);
 
-  std::vector<p2t::Triangle*> triangles = cdt->GetTriangles();
+  // roof: points of the triangulation are used directly as vertices, so each of them is stored just once
+  const QVector3D up(0, 1, 0);
+  const p2t::Point* firstPoint = arena->points.data();
+  const quint32 roofBase = vertexCount();
+  for (int i = 0; i < pointCount; ++i)
+    _addVertex(data, addNormals, firstPoint[i].x, extrusionHeight + arena->z[i], -firstPoint[i].y, up);
 
-  for (size_t i = 0; i < triangles.size(); ++i)
+  // most footprints (e.g. of buildings) are small rings without holes, the constrained
+  // Delaunay triangulation is only needed for the rest
+  if (polygon.numInteriorRings() != 0 || !_triangulateSimpleRing(arena, pointCount, roofBase, indices))
   {
-    p2t::Triangle* t = triangles[i];
-    for (int j = 0; j < 3; ++j)
+    p2t::Point* points = arena->points.data();
+    int first = exterior->numPoints() - 1;
+    arena->polyline.resize(first);
+    for (int i = 0; i < first; ++i)
+      arena->polyline[i] = points + i;
+
+    p2t::CDT& cdt = arena->cdt;
+    cdt.Reset(arena->polyline);
+
+    // polygon holes
+    for (int i = 0; i < polygon.numInteriorRings(); ++i)
     {
-      p2t::Point* p = t->GetPoint(j);
-      float zPt = z[p];
-      data << p->x << extrusionHeight + zPt << -p->y;
-      if (addNormals)
-        data << 0.f << 1.f << 0.f;
+      int count = polygon.interiorRing(i)->numPoints() - 1;
+      arena->holePolyline.resize(count);
+      for (int j = 0; j < count; ++j)
+        arena->holePolyline[j] = points + first + j;
+      cdt.AddHole(arena->holePolyline);
+      first += count;
     }
-  }
 
-  delete cdt;
-  for (int i = 0; i < polylinesToDelete.count(); ++i)
-    qDeleteAll(polylinesToDelete[i]);
+    // TODO: robustness (no duplicate / nearly duplicate points, ...)
+
+    cdt.Triangulate();
+
+    const std::vector<p2t::Triangle*>& triangles = cdt.GetTriangles();
+    for (size_t i = 0; i < triangles.size(); ++i)
+    {
+      p2t::Triangle* t = triangles[i];
+      for (int j = 0; j < 3; ++j)
+        indices << roofBase + quint32(t->GetPoint(j) - firstPoint);
+    }
+  }
 
   // add walls if extrusion is enabled
   if (extrusionHeight != 0)
   {
-    _makeWalls(*exterior, false, extrusionHeight, data, addNormals, originX, originY);
+    int first = exterior->numPoints() - 1;
+    _makeWalls(arena, 0, first, false, extrusionHeight, data, indices, addNormals);
 
     for (int i = 0; i < polygon.numInteriorRings(); ++i)
-      _makeWalls(*polygon.interiorRing(i), true, extrusionHeight, data, addNormals, originX, originY);
+    {
+      int count = polygon.interiorRing(i)->numPoints() - 1;
+      _makeWalls(arena, first, count, true, extrusionHeight, data, indices, addNormals);
+      first += count;
+    }
   }
 }
+
+//! unit vector perpendicular to the segment a-b, pointing to its left side
+static QVector2D _leftNormal(const p2t::Point& a, const p2t::Point& b)
+{
+  return QVector2D(-(b.y - a.y), b.x - a.x).normalized();
+}
+
+void Tessellator::addLineString(const QgsLineString &line, float width, float extrusionHeight)
+{
+  // arena holds the center line followed by the outline of the ribbon
+  // (2 points for each center point, or 4 points if the join gets beveled)
+  const int numPoints = line.numPoints();
+  if ((int)arena->points.size() < 5 * numPoints)
+    arena->points.resize(5 * numPoints);
+  if ((int)arena->z.size() < 5 * numPoints)
+    arena->z.resize(5 * numPoints);
+
+  p2t::Point* center = arena->points.data();
+  float* z = arena->z.data();
+  int n = 0;
+  for (int i = 0; i < numPoints; ++i)
+  {
+    double x = line.xAt(i) - originX, y = line.yAt(i) - originY;
+    if (n > 0 && center[n-1].x == x && center[n-1].y == y)
+      continue;  // repeated points have no direction
+    center[n].set(x, y);
+    z[n] = qIsNaN(line.zAt(i)) ? 0 : line.zAt(i);
+    ++n;
+  }
+  if (n < 2)
+    return;
+
+  // joins where the miter would be longer than the limit get beveled instead:
+  // the outer side gets a point for each of the two segments, the inner side uses its (limited) miter point twice
+  const float minCosHalfAngle = 1 / MAX_MITER_RATIO;
+  int m = n;   // number of right/left point pairs
+  for (int i = 1; i < n - 1; ++i)
+  {
+    if ((_leftNormal(center[i-1], center[i]) + _leftNormal(center[i], center[i+1])).length() / 2 < minCosHalfAngle)
+      ++m;
+  }
+
+  // outline goes forward along the right side and back along the left side
+  p2t::Point* outline = center + n;
+  float* outlineZ = z + n;
+  int k = 0;
+  auto addPair = [&](int i, const QVector2D& rightOffset, const QVector2D& leftOffset)
+  {
+    outline[k].set(center[i].x + rightOffset.x(), center[i].y + rightOffset.y());
+    outline[2*m-1-k].set(center[i].x + leftOffset.x(), center[i].y + leftOffset.y());
+    outlineZ[k] = outlineZ[2*m-1-k] = z[i];
+    ++k;
+  };
+
+  const float halfWidth = width / 2;
+  for (int i = 0; i < n; ++i)
+  {
+    if (i == 0 || i == n - 1)
+    {
+      QVector2D offset = (i == 0 ? _leftNormal(center[0], center[1]) : _leftNormal(center[n-2], center[n-1])) * halfWidth;
+      addPair(i, -offset, offset);
+      continue;
+    }
+
+    // miter join: offset along the bisector, stretched so that both segments keep their width
+    QVector2D nPrev = _leftNormal(center[i-1], center[i]);
+    QVector2D nNext = _leftNormal(center[i], center[i+1]);
+    QVector2D miter = nPrev + nNext;
+    float cosHalfAngle = miter.length() / 2;
+    if (cosHalfAngle >= minCosHalfAngle)
+    {
+      QVector2D offset = miter.normalized() * (halfWidth / cosHalfAngle);
+      addPair(i, -offset, offset);
+      continue;
+    }
+
+    // bevel join (the miter points to the inner side of the turn, if the line turns back there is no inner side)
+    QVector2D inner = cosHalfAngle < 1e-6 ? QVector2D() : miter.normalized() * (halfWidth / minCosHalfAngle);
+    bool turnsLeft = nPrev.x() * nNext.y() - nPrev.y() * nNext.x() >= 0;
+    if (turnsLeft)
+    {
+      addPair(i, -nPrev * halfWidth, inner);
+      addPair(i, -nNext * halfWidth, inner);
+    }
+    else
+    {
+      addPair(i, -inner, nPrev * halfWidth);
+      addPair(i, -inner, nNext * halfWidth);
+    }
+  }
+  Q_ASSERT(k == m);
+
+  int wallCount = extrusionHeight != 0 ? 2 * m : 0;
+  _reserveMore(data, int((2 * m + wallCount * (addNormals ? 4 : 2)) * stride / sizeof(float)));
+  _reserveMore(indices, 6 * (m - 1) + 6 * wallCount);
+
+  // top of the ribbon: a strip of quads between the pairs of right and left points
+  // (quads at bevels have two identical points, so they are just triangles)
+  const QVector3D up(0, 1, 0);
+  const quint32 base = vertexCount();
+  for (int i = 0; i < m; ++i)
+  {
+    const p2t::Point& left = outline[2*m-1-i];
+    const p2t::Point& right = outline[i];
+    _addVertex(data, addNormals, left.x, outlineZ[i] + extrusionHeight, -left.y, up);
+    _addVertex(data, addNormals, right.x, outlineZ[i] + extrusionHeight, -right.y, up);
+  }
+  for (int i = 0; i < m - 1; ++i)
+  {
+    quint32 left0 = base + 2 * i, right0 = left0 + 1;
+    quint32 left1 = left0 + 2, right1 = left0 + 3;
+    indices << right0 << right1 << left1 << right0 << left1 << left0;
+  }
+
+  // sides and ends of the ribbon are walls along its outline
+  if (extrusionHeight != 0)
+    _makeWalls(arena, n, 2 * m, false, extrusionHeight, data, indices, addNormals);
+}
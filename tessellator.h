@@ -1,10 +1,19 @@
 #ifndef TESSELLATOR_H
 #define TESSELLATOR_H
 
+class QgsLineString;
 class QgsPolygon;
+struct TessellatorArena;
 
 #include <QVector>
 
+//! Vertex and index data of tessellated polygons (indices start from zero)
+struct TessellatedMesh
+{
+  QVector<float> data;       //!< vertex data (see Tessellator::data)
+  QVector<quint32> indices;  //!< three vertex indices per triangle
+};
+
 class Tessellator
 {
 public:
@@ -12,18 +21,33 @@ public:
 
   void addPolygon(const QgsPolygon& polygon, float extrusionHeight);
 
+  //! Adds a flat ribbon of the given width along the line (with miter joins, beveled if too sharp, and flat ends),
+  //! z of each vertex is taken from the line. With extrusion the ribbon gets walls on its sides
+  void addLineString(const QgsLineString& line, float width, float extrusionHeight);
+
+  //! number of vertices in the output so far
+  int vertexCount() const { return data.count() * sizeof(float) / stride; }
+
   // input:
   // - origin X/Y
   // - whether to add walls
   // - stream of geometries
   // output:
-  // - vertex buffer data (+ index buffer data ?)
+  // - vertex buffer data + index buffer data (triangles)
 
   double originX, originY;
   bool addNormals;
   //QByteArray data;
   QVector<float> data;
+  QVector<quint32> indices;  //!< three vertex indices per triangle
   int stride;  //!< size of one vertex entry in bytes
+
+private:
+  Q_DISABLE_COPY(Tessellator)
+
+  //! memory reused by the triangulation of all polygons - shared by all tessellators of the creating thread,
+  //! so a tessellator must be used only in the thread that has created it
+  TessellatorArena* arena;
 };
 
 #endif // TESSELLATOR_H
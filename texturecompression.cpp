@@ -0,0 +1,121 @@
+#include "texturecompression.h"
+
+#include <QImage>
+
+#include <climits>
+
+
+static inline int _red(unsigned int p) { return (p >> 16) & 0xff; }
+static inline int _green(unsigned int p) { return (p >> 8) & 0xff; }
+static inline int _blue(unsigned int p) { return p & 0xff; }
+
+static inline unsigned short _toRgb565(int r, int g, int b)
+{
+  return (unsigned short)(((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3));
+}
+
+//! expands RGB565 color back to 8 bits per channel (the same way as GPU does it)
+static inline void _fromRgb565(unsigned short c, int* rgb)
+{
+  int r = (c >> 11) & 0x1f, g = (c >> 5) & 0x3f, b = c & 0x1f;
+  rgb[0] = (r << 3) | (r >> 2);
+  rgb[1] = (g << 2) | (g >> 4);
+  rgb[2] = (b << 3) | (b >> 2);
+}
+
+
+void compressBlockBC1(const unsigned int* pixels, unsigned char* output)
+{
+  // end points from the bounding box of colors in RGB space, inset a bit
+  // so that the interpolated colors cover the range better
+  int minRgb[3] = { 255, 255, 255 }, maxRgb[3] = { 0, 0, 0 };
+  for (int i = 0; i < 16; ++i)
+  {
+    int rgb[3] = { _red(pixels[i]), _green(pixels[i]), _blue(pixels[i]) };
+    for (int c = 0; c < 3; ++c)
+    {
+      if (rgb[c] < minRgb[c]) minRgb[c] = rgb[c];
+      if (rgb[c] > maxRgb[c]) maxRgb[c] = rgb[c];
+    }
+  }
+  for (int c = 0; c < 3; ++c)
+  {
+    int inset = (maxRgb[c] - minRgb[c]) >> 4;
+    minRgb[c] += inset;
+    maxRgb[c] -= inset;
+  }
+
+  // max >= min in every channel, so color0 >= color1 and the block is in the 4-color mode
+  // (if they are equal, the block is uniform and all indices are zero)
+  unsigned short color0 = _toRgb565(maxRgb[0], maxRgb[1], maxRgb[2]);
+  unsigned short color1 = _toRgb565(minRgb[0], minRgb[1], minRgb[2]);
+
+  unsigned int indices = 0;
+  if (color0 != color1)
+  {
+    int palette[4][3];
+    _fromRgb565(color0, palette[0]);
+    _fromRgb565(color1, palette[1]);
+    for (int c = 0; c < 3; ++c)
+    {
+      palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+      palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+
+    for (int i = 0; i < 16; ++i)
+    {
+      int r = _red(pixels[i]), g = _green(pixels[i]), b = _blue(pixels[i]);
+      int bestIndex = 0, bestDist = INT_MAX;
+      for (int j = 0; j < 4; ++j)
+      {
+        int dr = r - palette[j][0], dg = g - palette[j][1], db = b - palette[j][2];
+        int dist = dr*dr + dg*dg + db*db;
+        if (dist < bestDist)
+        {
+          bestDist = dist;
+          bestIndex = j;
+        }
+      }
+      indices |= quint32(bestIndex) << (2 * i);  // unsigned - the last index reaches the sign bit
+    }
+  }
+
+  // little endian
+  output[0] = color0 & 0xff;
+  output[1] = color0 >> 8;
+  output[2] = color1 & 0xff;
+  output[3] = color1 >> 8;
+  output[4] = indices & 0xff;
+  output[5] = (indices >> 8) & 0xff;
+  output[6] = (indices >> 16) & 0xff;
+  output[7] = indices >> 24;
+}
+
+
+QByteArray compressImageBC1(const QImage& image)
+{
+  QImage img = image.convertToFormat(QImage::Format_RGB32);
+  int width = img.width(), height = img.height();
+  int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+
+  QByteArray data;
+  data.resize(blocksX * blocksY * 8);
+  unsigned char* output = reinterpret_cast<unsigned char*>(data.data());
+
+  unsigned int block[16];
+  for (int by = 0; by < blocksY; ++by)
+  {
+    for (int bx = 0; bx < blocksX; ++bx)
+    {
+      for (int y = 0; y < 4; ++y)
+      {
+        const unsigned int* line = reinterpret_cast<const unsigned int*>(img.constScanLine(qMin(by * 4 + y, height - 1)));
+        for (int x = 0; x < 4; ++x)
+          block[y * 4 + x] = line[qMin(bx * 4 + x, width - 1)];
+      }
+      compressBlockBC1(block, output);
+      output += 8;
+    }
+  }
+  return data;
+}
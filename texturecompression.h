@@ -0,0 +1,16 @@
+#ifndef TEXTURECOMPRESSION_H
+#define TEXTURECOMPRESSION_H
+
+#include <QByteArray>
+
+class QImage;
+
+//! Compresses an opaque image to BC1 (DXT1) format: every 4x4 block of pixels is stored in 8 bytes
+//! (two RGB565 end point colors + 2-bit index for each pixel). Alpha channel is ignored.
+//! Images with size not divisible by four are padded by repeating edge pixels
+QByteArray compressImageBC1(const QImage& image);
+
+//! Compresses a block of 4x4 pixels (0xAARRGGBB values, row by row) to 8 bytes of BC1 data
+void compressBlockBC1(const unsigned int* pixels, unsigned char* output);
+
+#endif // TEXTURECOMPRESSION_H
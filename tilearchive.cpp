@@ -0,0 +1,185 @@
+#include "tilearchive.h"
+
+#include <QDir>
+#include <QtDebug>
+#include <QtEndian>
+
+//! the data file is mapped with at least this size
+static const qint64 MIN_MAPPED_SIZE = 16 * 1024 * 1024;
+
+//! Record in the index file (all fields little endian)
+struct IndexRecord
+{
+  qint32 z, x, y;
+  quint32 size;
+  quint64 offset;
+};
+
+
+TileArchiveMapping::~TileArchiveMapping()
+{
+  archive->unmap(data);
+}
+
+
+TileArchive::TileArchive(const QString &fileName)
+  : mMutex(QMutex::Recursive)
+  , mDataFile(fileName)
+  , mIndexFile(fileName + ".idx")
+  , mDataEnd(0)
+  , mValid(false)
+{
+  if (!mDataFile.open(QIODevice::ReadWrite) || !mIndexFile.open(QIODevice::ReadWrite))
+  {
+    qDebug() << "failed to open tile archive " << fileName;
+    return;
+  }
+
+  qint64 dataSize = mDataFile.size();
+  QByteArray indexData = mIndexFile.readAll();
+  int recordCount = indexData.count() / sizeof(IndexRecord);
+  const IndexRecord* records = (const IndexRecord*) indexData.constData();
+  for (int i = 0; i < recordCount; ++i)
+  {
+    const IndexRecord& r = records[i];
+    Entry e;
+    e.offset = qFromLittleEndian(r.offset);
+    e.size = qFromLittleEndian(r.size);
+    if (e.offset + e.size > (quint64) dataSize)
+      break;  // incomplete write - ignore the rest of the index
+
+    mIndex.insert(tileKey(qFromLittleEndian(r.x), qFromLittleEndian(r.y), qFromLittleEndian(r.z)), e);
+    mDataEnd = qMax(mDataEnd, qint64(e.offset + e.size));
+  }
+
+  // drop any partially written records so that new records are appended properly
+  if (mIndex.count() != recordCount || indexData.count() % sizeof(IndexRecord))
+    mIndexFile.resize(qint64(mIndex.count()) * sizeof(IndexRecord));
+
+  mValid = true;
+}
+
+TileArchive::~TileArchive()
+{
+  // give back the reserved space (readers must be done with the tiles by now)
+  mMapping.clear();
+  if (mValid && mDataFile.size() > mDataEnd)
+    mDataFile.resize(mDataEnd);
+  mDataFile.close();
+  mIndexFile.close();
+}
+
+bool TileArchive::isValid() const
+{
+  return mValid;
+}
+
+int TileArchive::count() const
+{
+  QMutexLocker locker(&mMutex);
+  return mIndex.count();
+}
+
+bool TileArchive::contains(int x, int y, int z) const
+{
+  QMutexLocker locker(&mMutex);
+  return mIndex.contains(tileKey(x, y, z));
+}
+
+TileData TileArchive::tileData(int x, int y, int z)
+{
+  QMutexLocker locker(&mMutex);
+  TileData tile;
+  auto it = mIndex.constFind(tileKey(x, y, z));
+  if (it == mIndex.constEnd())
+    return tile;
+
+  const Entry& e = it.value();
+  if (!ensureMapped(e.offset + e.size))
+    return tile;
+
+  tile.mapping = mMapping;
+  tile.data = QByteArray::fromRawData((const char*) mMapping->data + e.offset, e.size);
+  return tile;
+}
+
+bool TileArchive::addTile(int x, int y, int z, const QByteArray &data)
+{
+  QMutexLocker locker(&mMutex);
+  if (!mValid || mIndex.contains(tileKey(x, y, z)))
+    return false;
+
+  // first write the blob, only then the index record - so that the index never points to incomplete data.
+  // The file is not truncated on failure: it may be mapped and the space after the data is reserved anyway
+  qint64 offset = mDataEnd;
+  if (!mDataFile.seek(offset) || mDataFile.write(data) != data.count() || !mDataFile.flush())
+    return false;
+  mDataEnd = offset + data.count();
+
+  IndexRecord r;
+  r.z = qToLittleEndian(qint32(z));
+  r.x = qToLittleEndian(qint32(x));
+  r.y = qToLittleEndian(qint32(y));
+  r.size = qToLittleEndian(quint32(data.count()));
+  r.offset = qToLittleEndian(quint64(offset));
+  if (!mIndexFile.seek(mIndexFile.size()) || mIndexFile.write((const char*) &r, sizeof(IndexRecord)) != sizeof(IndexRecord) || !mIndexFile.flush())
+    return false;
+
+  Entry e;
+  e.offset = offset;
+  e.size = data.count();
+  mIndex.insert(tileKey(x, y, z), e);
+  return true;
+}
+
+int TileArchive::importDirectory(const QString &dirPath, const QString &prefix)
+{
+  QDir dir(dirPath);
+  int imported = 0;
+  Q_FOREACH (const QString& fileName, dir.entryList(QStringList() << prefix + "-*", QDir::Files))
+  {
+    QStringList parts = fileName.mid(prefix.length() + 1).split('-');
+    if (parts.count() != 3)
+      continue;
+
+    bool okZ, okX, okY;
+    int z = parts[0].toInt(&okZ), x = parts[1].toInt(&okX), y = parts[2].toInt(&okY);
+    if (!okZ || !okX || !okY || contains(x, y, z))
+      continue;
+
+    QFile f(dir.filePath(fileName));
+    if (!f.open(QIODevice::ReadOnly))
+      continue;
+
+    if (addTile(x, y, z, f.readAll()))
+      ++imported;
+  }
+  return imported;
+}
+
+bool TileArchive::ensureMapped(qint64 size)
+{
+  qint64 mappedSize = mMapping ? mMapping->size : 0;
+  if (size <= mappedSize)
+    return true;
+
+  // the data have grown beyond the mapping: reserve space in the file so that the next
+  // remap is needed only once the mapping doubles. Readers may still use the old mapping,
+  // it gets unmapped when they are done
+  qint64 newSize = qMax(qMax(size, mappedSize * 2), MIN_MAPPED_SIZE);
+  if (mDataFile.size() < newSize && !mDataFile.resize(newSize))
+    return false;
+
+  uchar* data = mDataFile.map(0, newSize);
+  if (!data)
+    return false;
+
+  mMapping = QSharedPointer<TileArchiveMapping>::create(this, data, newSize);
+  return true;
+}
+
+void TileArchive::unmap(uchar *data)
+{
+  QMutexLocker locker(&mMutex);
+  mDataFile.unmap(data);
+}
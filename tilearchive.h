@@ -0,0 +1,91 @@
+#ifndef TILEARCHIVE_H
+#define TILEARCHIVE_H
+
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QSharedPointer>
+
+class TileArchive;
+
+//! One mapping of the archive's data file. It gets unmapped when the last reference is gone
+struct TileArchiveMapping
+{
+  TileArchiveMapping(TileArchive* archive, uchar* data, qint64 size) : archive(archive), data(data), size(size) {}
+  ~TileArchiveMapping();
+
+  TileArchive* archive;
+  uchar* data;
+  qint64 size;
+};
+
+//! Data of a tile read from the archive. The byte array refers directly to the archive's mapping
+//! (no copy), which is kept alive for as long as the object exists (it must not outlive the archive)
+struct TileData
+{
+  QByteArray data;
+  QSharedPointer<TileArchiveMapping> mapping;
+};
+
+/**
+ * Single-file store of tiles: blobs of tile data are appended one after another
+ * to a data file and their positions are recorded in an index file (with ".idx" suffix).
+ * The data file is memory-mapped, so reading a tile is just a lookup in the index - the returned
+ * data point directly to the mapping. The file is mapped with some space reserved after the data,
+ * so it is remapped only when the mapping has to double its size. A replaced mapping stays valid
+ * until the last reader of its tiles is done with them.
+ * Writes are append-only: a tile is written once and never updated or removed.
+ *
+ * The class is thread-safe.
+ */
+class TileArchive
+{
+public:
+  //! Opens (or creates) archive with the given data file name
+  TileArchive(const QString& fileName);
+  ~TileArchive();
+
+  //! Whether the archive files could be opened
+  bool isValid() const;
+
+  //! Returns number of tiles in the archive
+  int count() const;
+
+  //! Returns whether the archive contains given tile
+  bool contains(int x, int y, int z) const;
+
+  //! Returns data of a tile (empty if the tile is not in the archive). The data are not copied,
+  //! the returned object keeps the mapping alive even if the archive gets remapped meanwhile
+  TileData tileData(int x, int y, int z);
+
+  //! Appends tile data to the archive. Returns false if the tile already exists or on write error
+  bool addTile(int x, int y, int z, const QByteArray& data);
+
+  //! Imports tiles stored as individual files "<prefix>-Z-X-Y" in the given directory.
+  //! Tiles that already exist in the archive are skipped. Returns number of imported tiles
+  int importDirectory(const QString& dirPath, const QString& prefix);
+
+private:
+  friend struct TileArchiveMapping;
+
+  static quint64 tileKey(int x, int y, int z) { return (quint64(z) << 58) | (quint64(x) << 29) | quint64(y); }
+
+  bool ensureMapped(qint64 size);
+  void unmap(uchar* data);
+
+  struct Entry
+  {
+    quint64 offset;  //!< position of the blob in the data file
+    quint32 size;    //!< size of the blob in bytes
+  };
+
+  mutable QMutex mMutex;   //!< recursive: the last reference to a mapping may be dropped while holding it
+  QFile mDataFile;
+  QFile mIndexFile;
+  QHash<quint64, Entry> mIndex;
+  QSharedPointer<TileArchiveMapping> mMapping;   //!< current mapping of the data file (including the reserved space)
+  qint64 mDataEnd;      //!< end of the tile data - the file may be bigger (space reserved for appending)
+  bool mValid;
+};
+
+#endif // TILEARCHIVE_H
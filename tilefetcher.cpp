@@ -0,0 +1,244 @@
+#include "tilefetcher.h"
+
+#include "tilearchive.h"
+
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QTimer>
+#include <QtDebug>
+
+#include "qgsnetworkaccessmanager.h"
+
+
+//! whether it makes sense to try the request again - the server or the network may be just busy
+static bool _isTransientError(QNetworkReply* reply)
+{
+  int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+  if (status != 0)
+    return status == 408 || status == 429 || status >= 500;
+
+  switch (reply->error())
+  {
+    case QNetworkReply::ConnectionRefusedError:
+    case QNetworkReply::RemoteHostClosedError:
+    case QNetworkReply::TimeoutError:
+    case QNetworkReply::OperationCanceledError:   // aborted by our timeout
+    case QNetworkReply::TemporaryNetworkFailureError:
+    case QNetworkReply::NetworkSessionFailedError:
+    case QNetworkReply::UnknownNetworkError:
+    case QNetworkReply::ProxyConnectionClosedError:
+    case QNetworkReply::ProxyTimeoutError:
+      return true;
+    default:
+      return false;
+  }
+}
+
+
+TileFetcher::TileFetcher(TileArchive *archive, const QString &urlTemplate)
+  : mArchive(archive)
+  , mStopping(false)
+  , mUrlTemplate(urlTemplate)
+{
+  mWorker = new TileFetcherWorker(this);
+  mWorker->moveToThread(&mThread);
+  // the worker (with its replies and timers) gets deleted in its own thread when the thread finishes
+  connect(&mThread, &QThread::finished, mWorker, &QObject::deleteLater);
+  mThread.start();
+}
+
+TileFetcher::~TileFetcher()
+{
+  Q_ASSERT(QThread::currentThread() != &mThread);
+
+  mWaitMutex.lock();
+  mStopping = true;
+  mWaitCondition.wakeAll();
+  mWaitMutex.unlock();
+
+  mThread.quit();
+  mThread.wait();
+}
+
+QString TileFetcher::urlTemplate() const
+{
+  QMutexLocker locker(&mWaitMutex);
+  return mUrlTemplate;
+}
+
+void TileFetcher::setUrlTemplate(const QString &url)
+{
+  QMutexLocker locker(&mWaitMutex);
+  mUrlTemplate = url;
+  mFailed.clear();  // tiles may be available from the new URL
+}
+
+void TileFetcher::requestTile(int x, int y, int z)
+{
+  // always processed in the worker's thread
+  QMetaObject::invokeMethod(mWorker, "enqueueTile", Qt::QueuedConnection, Q_ARG(int, x), Q_ARG(int, y), Q_ARG(int, z), Q_ARG(int, 0), Q_ARG(bool, false));
+}
+
+bool TileFetcher::waitForTile(int x, int y, int z, const QAtomicInt* cancelled)
+{
+  Q_ASSERT(QThread::currentThread() != &mThread);
+
+  if (mArchive->contains(x, y, z))
+    return true;
+
+  quint64 key = tileKey(x, y, z);
+  QMutexLocker locker(&mWaitMutex);
+  mFailed.remove(key);  // give it another try if it failed before
+  // the tile is most likely queued already - make sure it is downloaded next
+  QMetaObject::invokeMethod(mWorker, "enqueueTile", Qt::QueuedConnection, Q_ARG(int, x), Q_ARG(int, y), Q_ARG(int, z), Q_ARG(int, 0), Q_ARG(bool, true));
+
+  while (!mArchive->contains(x, y, z) && !mFailed.contains(key) && !mStopping && !(cancelled && cancelled->load()))
+    mWaitCondition.wait(&mWaitMutex);
+
+  return mArchive->contains(x, y, z);
+}
+
+void TileFetcher::cancelWaiting()
+{
+  // taking the mutex makes sure that a waiting thread either has not checked its flag yet or is already waiting
+  QMutexLocker locker(&mWaitMutex);
+  mWaitCondition.wakeAll();
+}
+
+void TileFetcher::cancelTile(int x, int y, int z)
+{
+  QMetaObject::invokeMethod(mWorker, "dequeueTile", Qt::QueuedConnection, Q_ARG(int, x), Q_ARG(int, y), Q_ARG(int, z));
+}
+
+void TileFetcher::finishTile(int x, int y, int z, bool success)
+{
+  mWaitMutex.lock();
+  if (!success)
+    mFailed.insert(tileKey(x, y, z));
+  mWaitCondition.wakeAll();
+  mWaitMutex.unlock();
+
+  emit tileFetched(x, y, z, success);
+}
+
+// ---------------
+
+TileFetcherWorker::TileFetcherWorker(TileFetcher *fetcher)
+  : mFetcher(fetcher)
+{
+}
+
+TileFetcherWorker::~TileFetcherWorker()
+{
+  // runs in our thread, so it is safe to get rid of the replies
+  for (auto it = mReplies.constBegin(); it != mReplies.constEnd(); ++it)
+  {
+    QNetworkReply* reply = it.key();
+    disconnect(reply, nullptr, this, nullptr);
+    reply->abort();
+    delete reply;
+  }
+}
+
+void TileFetcherWorker::enqueueTile(int x, int y, int z, int attempt, bool urgent)
+{
+  quint64 key = TileFetcher::tileKey(x, y, z);
+  if (attempt == 0)
+  {
+    if (mPending.contains(key))
+    {
+      // already on the way - just move it to the front if it is still in the queue
+      int index = urgent ? queueIndex(key) : -1;
+      if (index != -1)
+        mQueue.append(mQueue.takeAt(index));
+      return;
+    }
+    if (mFetcher->mArchive->contains(x, y, z))
+    {
+      mFetcher->finishTile(x, y, z, true);
+      return;
+    }
+    mPending.insert(key);
+  }
+
+  TileRequest r;
+  r.x = x;
+  r.y = y;
+  r.z = z;
+  r.attempt = attempt;
+  mQueue.append(r);
+  startRequests();
+}
+
+void TileFetcherWorker::dequeueTile(int x, int y, int z)
+{
+  int index = queueIndex(TileFetcher::tileKey(x, y, z));
+  if (index == -1)
+    return;  // running, waiting for retry or done
+
+  mQueue.removeAt(index);
+  mPending.remove(TileFetcher::tileKey(x, y, z));
+}
+
+int TileFetcherWorker::queueIndex(quint64 key) const
+{
+  for (int i = 0; i < mQueue.count(); ++i)
+  {
+    const TileRequest& r = mQueue.at(i);
+    if (TileFetcher::tileKey(r.x, r.y, r.z) == key)
+      return i;
+  }
+  return -1;
+}
+
+void TileFetcherWorker::startRequests()
+{
+  while (mReplies.count() < mFetcher->maxConcurrentRequests && !mQueue.isEmpty())
+  {
+    TileRequest r = mQueue.takeLast();
+
+    QString url = mFetcher->urlTemplate();
+    url.replace("{x}", QString::number(r.x)).replace("{y}", QString::number(r.y)).replace("{z}", QString::number(r.z));
+
+    QNetworkRequest request(url);
+    request.setRawHeader(QByteArray("Accept-Encoding"), QByteArray("gzip"));
+    request.setRawHeader(QByteArray("Accept"), QByteArray("application/vnd.quantized-mesh,application/octet-stream;q=0.9"));
+    request.setRawHeader(QByteArray("User-Agent"), QByteArray("Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Ubuntu Chromium/58.0.3029.110 Chrome/58.0.3029.110 Safari/537.36"));
+    // the network access manager is per-thread, so this one belongs to our thread
+    QNetworkReply* reply = QgsNetworkAccessManager::instance()->get(request);
+    connect(reply, &QNetworkReply::finished, this, &TileFetcherWorker::onReplyFinished);
+    // the timer is gone together with the reply if it finishes in time
+    QTimer::singleShot(mFetcher->requestTimeout, reply, [reply] { reply->abort(); });
+    mReplies.insert(reply, r);
+  }
+}
+
+void TileFetcherWorker::onReplyFinished()
+{
+  QNetworkReply* reply = static_cast<QNetworkReply*>(sender());
+  Q_ASSERT(mReplies.contains(reply));
+  TileRequest r = mReplies.take(reply);
+  reply->deleteLater();
+
+  if (reply->error() == QNetworkReply::NoError)
+  {
+    TileArchive* archive = mFetcher->mArchive;
+    bool success = archive->addTile(r.x, r.y, r.z, reply->readAll()) || archive->contains(r.x, r.y, r.z);
+    mPending.remove(TileFetcher::tileKey(r.x, r.y, r.z));
+    mFetcher->finishTile(r.x, r.y, r.z, success);
+  }
+  else if (r.attempt < mFetcher->maxRetries && _isTransientError(reply))
+  {
+    int delay = mFetcher->retryDelay * (1 << r.attempt);
+    qDebug() << "tile download failed, retrying in " << delay << " ms: " << r.x << " " << r.y << " " << r.z << " " << reply->errorString();
+    QTimer::singleShot(delay, this, [this, r] { enqueueTile(r.x, r.y, r.z, r.attempt + 1, false); });
+  }
+  else
+  {
+    qDebug() << "tile download failed: " << r.x << " " << r.y << " " << r.z << " " << reply->errorString();
+    mPending.remove(TileFetcher::tileKey(r.x, r.y, r.z));
+    mFetcher->finishTile(r.x, r.y, r.z, false);
+  }
+
+  startRequests();
+}
@@ -0,0 +1,123 @@
+#ifndef TILEFETCHER_H
+#define TILEFETCHER_H
+
+#include <QAtomicInt>
+#include <QHash>
+#include <QMutex>
+#include <QObject>
+#include <QList>
+#include <QSet>
+#include <QThread>
+#include <QWaitCondition>
+
+class QNetworkReply;
+class TileArchive;
+class TileFetcherWorker;
+
+/**
+ * Asynchronous downloader of tiles into a tile archive.
+ *
+ * - the downloads run in the fetcher's own thread with an event loop, so that requests get processed
+ *   even when other threads are blocked (e.g. waiting for a tile)
+ * - at most a given number of requests is running at once (the connections are kept alive
+ *   and reused by the network access manager)
+ * - requests for a tile that is already queued or being downloaded are coalesced
+ * - the most recent requests are downloaded first (like chunk loaders take the most recent requests first),
+ *   a tile that somebody waits for is moved to the front of the queue
+ * - transient failures (timeouts, connection errors, 5xx responses) are retried with exponential backoff,
+ *   permanent ones (e.g. 404) fail right away
+ *
+ * The URL template may contain {x}, {y} and {z} placeholders.
+ */
+class TileFetcher : public QObject
+{
+  Q_OBJECT
+public:
+  TileFetcher(TileArchive* archive, const QString& urlTemplate);
+  //! Stops the fetcher's thread. The objects living in that thread (including pending replies)
+  //! are destroyed in it. Must not be called from the fetcher's thread
+  ~TileFetcher();
+
+  QString urlTemplate() const;
+  //! Changes URL of tiles. Requests that are already running are not affected. Can be called from any thread
+  void setUrlTemplate(const QString& url);
+
+  //! Asynchronously requests download of a tile (if it is not in the archive yet). Can be called from any thread
+  void requestTile(int x, int y, int z);
+
+  //! Requests a tile and blocks until it is in the archive. Returns false if the download failed
+  //! or if the wait got cancelled (the flag is set and cancelWaiting() is called). Must not be called from the fetcher's thread
+  bool waitForTile(int x, int y, int z, const QAtomicInt* cancelled = nullptr);
+
+  //! Wakes up threads blocked in waitForTile() so that they check their cancellation flags
+  void cancelWaiting();
+
+  //! Drops a queued request for the tile (the download is not interrupted if it has started already).
+  //! Can be called from any thread
+  void cancelTile(int x, int y, int z);
+
+  int maxConcurrentRequests = 6;  //!< how many requests may run in parallel
+  int maxRetries = 3;             //!< how many times to retry a request that failed for a transient reason
+  int retryDelay = 500;           //!< delay before the first retry (in milliseconds), doubled with each retry
+  int requestTimeout = 30000;     //!< requests running longer than this (in milliseconds) are aborted and retried
+
+signals:
+  //! emitted (in fetcher's thread) when a tile has been downloaded or when it finally failed
+  void tileFetched(int x, int y, int z, bool success);
+
+private:
+  friend class TileFetcherWorker;
+
+  static quint64 tileKey(int x, int y, int z) { return (quint64(z) << 58) | (quint64(x) << 29) | quint64(y); }
+
+  //! called by the worker when a tile has been downloaded or it finally failed
+  void finishTile(int x, int y, int z, bool success);
+
+  TileArchive* mArchive;
+  QThread mThread;
+  TileFetcherWorker* mWorker;  //!< lives in the fetcher's thread and gets deleted there
+
+  // used for synchronization with waiting threads
+  mutable QMutex mWaitMutex;
+  QWaitCondition mWaitCondition;
+  QSet<quint64> mFailed;
+  bool mStopping;
+  QString mUrlTemplate;
+};
+
+
+//! Part of the tile fetcher that lives in the fetcher's thread (queue of requests and network replies)
+class TileFetcherWorker : public QObject
+{
+  Q_OBJECT
+public:
+  TileFetcherWorker(TileFetcher* fetcher);
+  ~TileFetcherWorker();
+
+public slots:
+  //! Adds request to the queue. Urgent requests go to the front of the queue (also if already queued)
+  void enqueueTile(int x, int y, int z, int attempt, bool urgent);
+  void dequeueTile(int x, int y, int z);
+
+private slots:
+  void onReplyFinished();
+
+private:
+  void startRequests();
+
+  struct TileRequest
+  {
+    int x, y, z;
+    int attempt;  //!< zero for the first try
+  };
+
+  //! index of the queued request for a tile (-1 if not queued)
+  int queueIndex(quint64 key) const;
+
+  TileFetcher* mFetcher;
+  QList<TileRequest> mQueue;   //!< requests are taken from the end
+  QHash<QNetworkReply*, TileRequest> mReplies;
+  QSet<quint64> mPending;   //!< tiles that are queued, being downloaded or waiting for retry
+};
+
+#endif // TILEFETCHER_H